@@ -0,0 +1,307 @@
+#include "bench.h"
+
+#include "defs.h"
+#include "kalloc.h"
+#include "loader.h"
+#include "proc.h"
+#include "syscall.h"
+#include "timer.h"
+#include "trap.h"
+#include "vm.h"
+
+#ifdef PROC_BENCH
+// Kernel benchmarks, run at boot with -DPROC_BENCH.
+// They run in kernel threads (see kthread_create), before the init proc starts:
+//  the first thread takes pool[0], runs them all, then execs INIT_PROC and becomes init_proc.
+// Time is measured with get_cycle(), which counts at CPU_FREQ.
+
+static uint64 cycles_to_ns(uint64 cycles) {
+    return cycles * 1000000000 / CPU_FREQ;
+}
+
+// Report n runs of name which took cycles, with the throughput if they processed bytes.
+static void bench_report(const char *name, uint64 n, uint64 bytes, uint64 cycles) {
+    uint64 ns = cycles_to_ns(cycles);
+    printf("%s: %d runs, %d ns per run", name, (int)n, (int)(ns / (n ? n : 1)));
+    if (bytes != 0)
+        printf(", %d MB/s", (int)(bytes * 1000 / (ns ? ns : 1)));
+    printf("\n");
+}
+
+// Time n runs of stmt, r is the run index.
+#define BENCH(name, n, bytes, stmt)                        \
+    do {                                                   \
+        uint64 start = get_cycle();                        \
+        for (int r = 0; r < (n); r++) stmt;                \
+        bench_report(name, n, bytes, get_cycle() - start); \
+    } while (0)
+
+// busy loop for cycles, without yielding.
+static void spin(uint64 cycles) {
+    uint64 start = get_cycle();
+    while (get_cycle() - start < cycles);
+}
+
+// string.c: the mem* functions against byte loops, on BENCH_SIZE bytes.
+// Byte-wise references, as string.c was before the word-wise versions.
+static void bench_memset_bytes(volatile char *d, int c, uint n) {
+    while (n-- > 0) *d++ = c;
+}
+
+static void bench_memmove_bytes(volatile char *d, volatile const char *s, uint n) {
+    while (n-- > 0) *d++ = *s++;
+}
+
+static int bench_memcmp_bytes(volatile const uchar *s1, volatile const uchar *s2, uint n) {
+    while (n-- > 0) {
+        if (*s1 != *s2)
+            return *s1 - *s2;
+        s1++, s2++;
+    }
+    return 0;
+}
+
+#define BENCH_ORDER (4)
+#define BENCH_SIZE  (PGSIZE << BENCH_ORDER)
+#define BENCH_ROUND (16)
+
+static void string_bench() {
+    char *a = (char *)PA_TO_KVA(kallocpages(BENCH_ORDER));
+    char *b = (char *)PA_TO_KVA(kallocpages(BENCH_ORDER));
+    volatile int sink = 0;
+    uint64 bytes      = (uint64)BENCH_SIZE * BENCH_ROUND;
+
+    BENCH("memset  (bytes)", BENCH_ROUND, bytes, bench_memset_bytes(a, r, BENCH_SIZE));
+    BENCH("memset  (words)", BENCH_ROUND, bytes, memset(a, r, BENCH_SIZE));
+    BENCH("clear_page     ", BENCH_ROUND, bytes,
+          for (uint64 off = 0; off < BENCH_SIZE; off += PGSIZE) clear_page(a + off));
+    BENCH("memmove (bytes)", BENCH_ROUND, bytes, bench_memmove_bytes(b, a, BENCH_SIZE));
+    BENCH("memmove (words)", BENCH_ROUND, bytes, memmove(b, a, BENCH_SIZE));
+    BENCH("copy_page      ", BENCH_ROUND, bytes,
+          for (uint64 off = 0; off < BENCH_SIZE; off += PGSIZE) copy_page(b + off, a + off));
+    BENCH("memcmp  (bytes)", BENCH_ROUND, bytes, sink += bench_memcmp_bytes((uchar *)a, (uchar *)b, BENCH_SIZE));
+    BENCH("memcmp  (words)", BENCH_ROUND, bytes, sink += memcmp(a, b, BENCH_SIZE));
+
+    kfreepages((void *)KVA_TO_PA(a), BENCH_ORDER);
+    kfreepages((void *)KVA_TO_PA(b), BENCH_ORDER);
+}
+
+// Reap all children of the current process.
+static void wait_all() {
+    while (wait(-1, NULL) > 0);
+}
+
+// context switch throughput: k threads yield in a loop for YIELD_TICKS, for k = 1..NCPU.
+// With one thread per cpu, the switches/ms should scale with k if the run queues do not contend.
+#define YIELD_TICKS (TICKS_PER_SEC / 2)
+
+static volatile int yield_stop;
+static uint64 yield_count;
+
+static void yield_thread(uint64 arg) {
+    uint64 n = 0;
+    while (!yield_stop) {
+        yield();
+        n++;
+    }
+    __atomic_fetch_add(&yield_count, n, __ATOMIC_RELAXED);
+}
+
+static void yield_bench() {
+    printf("yield: switches/ms with k threads, %d ms each\n", YIELD_TICKS * 1000 / TICKS_PER_SEC);
+    for (int k = 1; k <= NCPU; k++) {
+        yield_stop  = 0;
+        yield_count = 0;
+        for (int i = 0; i < k; i++) kthread_create(yield_thread, 0);
+        uint64 start = get_cycle();
+        sleep_ticks(YIELD_TICKS);
+        yield_stop = 1;
+        wait_all();
+        uint64 ns = cycles_to_ns(get_cycle() - start);
+        printf("  k = %d: %d switches, %d switches/ms\n", k, (int)yield_count, (int)(yield_count * 1000000 / ns));
+    }
+}
+
+// create and reap: REAP_ROUNDS rounds of REAP_BATCH children which exit at once.
+// The orphan variant lets a middle thread exit before its children, they are reparented
+//  to init_proc, which is the benchmark thread itself, and reaped there.
+#define REAP_BATCH  (256)
+#define REAP_ROUNDS (16)
+
+static void exit_thread(uint64 arg) {
+}
+
+static void orphan_parent_thread(uint64 arg) {
+    for (int i = 0; i < REAP_BATCH; i++) kthread_create(exit_thread, 0);
+}
+
+static void reap_bench() {
+    int n        = 0;
+    uint64 start = get_cycle();
+    for (int r = 0; r < REAP_ROUNDS; r++) {
+        for (int i = 0; i < REAP_BATCH; i++) n += kthread_create(exit_thread, 0) > 0;
+        wait_all();
+    }
+    bench_report("reap", n, 0, get_cycle() - start);
+
+    start = get_cycle();
+    for (int r = 0; r < REAP_ROUNDS; r++) {
+        kthread_create(orphan_parent_thread, 0);
+        wait_all();
+    }
+    bench_report("reap orphans", REAP_ROUNDS * (REAP_BATCH + 1), 0, get_cycle() - start);
+}
+
+// Launch latency of spawn() against fork() + exec() of the same app, LAUNCH_ROUNDS times each.
+// Only the memory work is timed: the children are freed without ever running.
+#define LAUNCH_ROUNDS (64)
+
+static void launch_bench(char *name) {
+    struct user_app *app = get_elf(name);
+    struct proc *parent  = allocproc();
+    if (app == NULL || parent == NULL || load_user_elf(app, parent) < 0)
+        panic("launch_bench");
+
+    uint64 spawn_cycles = 0, fork_exec_cycles = 0;
+    for (int r = 0; r < LAUNCH_ROUNDS; r++) {
+        uint64 start    = get_cycle();
+        struct proc *np = allocproc();
+        if (np == NULL || load_user_elf(app, np) < 0)
+            panic("spawn");
+        spawn_cycles += get_cycle() - start;
+        proc_discard(np);
+
+        start = get_cycle();
+        np    = allocproc();
+        if (np == NULL || mm_copy(parent->mm, np->mm))
+            panic("fork");
+        mm_free_pages(np->mm);
+        if (load_user_elf(app, np) < 0)
+            panic("exec");
+        fork_exec_cycles += get_cycle() - start;
+        proc_discard(np);
+    }
+    proc_discard(parent);
+
+    printf("launch %s:\n", name);
+    bench_report("  spawn        ", LAUNCH_ROUNDS, 0, spawn_cycles);
+    bench_report("  fork + exec  ", LAUNCH_ROUNDS, 0, fork_exec_cycles);
+}
+
+// cpu share of priorities: threads spin for a fixed slice and yield, for SHARE_TICKS.
+// Kernel threads are never preempted, so every slice is one dequeue and cpu time ~ slices.
+#define SHARE_TICKS (2 * TICKS_PER_SEC)
+#define SHARE_SLICE (CPU_FREQ / 10000)
+// tolerated deviation from the expected share, in percent of it.
+// rr shares are approximate (see rr_next_pass), and with several harts work stealing moves threads.
+#define SHARE_TOLERANCE (20)
+
+// 0 stays in the default rr class.
+static const int share_prio[] = {0, 4, 8, 16, 32};
+#define NR_SHARE (sizeof(share_prio) / sizeof(share_prio[0]))
+
+static volatile int share_stop;
+static uint64 share_slices[NR_SHARE];
+
+static void share_thread(uint64 i) {
+    struct proc *p = curr_proc();
+    if (share_prio[i] != 0) {
+        acquire(&p->lock);
+        sched_set_priority(p, share_prio[i]);
+        release(&p->lock);
+    }
+    while (!share_stop) {
+        spin(SHARE_SLICE);
+        __atomic_fetch_add(&share_slices[i], 1, __ATOMIC_RELAXED);
+        yield();
+    }
+}
+
+static void sched_share_bench() {
+    printf("sched share: %d threads of each priority, %d ms\n", NCPU, SHARE_TICKS * 1000 / TICKS_PER_SEC);
+    share_stop = 0;
+    // NCPU threads of each priority, so every cpu has a mix of them.
+    for (int n = 0; n < NCPU; n++) {
+        for (int i = 0; i < NR_SHARE; i++) kthread_create(share_thread, i);
+    }
+    sleep_ticks(SHARE_TICKS);
+    share_stop = 1;
+    wait_all();
+
+    uint64 total_slices = 0, total_prio = 0;
+    for (int i = 0; i < NR_SHARE; i++) {
+        total_slices += share_slices[i];
+        total_prio += share_prio[i] ? share_prio[i] : DEFAULT_PRIORITY;
+    }
+    int off = 0;
+    for (int i = 0; i < NR_SHARE; i++) {
+        int prio = share_prio[i] ? share_prio[i] : DEFAULT_PRIORITY;
+        // per mille, to avoid floating point.
+        int64 share    = share_slices[i] * 1000 / (total_slices ? total_slices : 1);
+        int64 expected = prio * 1000 / total_prio;
+        int ok         = (share > expected ? share - expected : expected - share) * 100 <= expected * SHARE_TOLERANCE;
+        off += !ok;
+        printf("  prio %d%s: %d slices, share %d/1000, expected %d/1000%s\n", prio, share_prio[i] ? "" : " (rr)",
+               (int)share_slices[i], (int)share, (int)expected, ok ? "" : ", off");
+    }
+    if (off)
+        printf("sched share: %d priorities off by more than %d%%\n", off, SHARE_TOLERANCE);
+    else
+        printf("sched share: all within %d%% of the stride ratios\n", SHARE_TOLERANCE);
+}
+
+// Kernel side of a syscall round trip.
+//  - dispatch: getppid through syscall() against a direct call of the handler,
+//    the difference is what the syscall_table dispatch costs.
+//  - result store: an int stored to user memory as sys_wait() did before uaccess.c,
+//    with useraddr() under p->lock and mm->lock, against copy_to_user() under SUM.
+#define SYSCALL_ROUNDS (4096)
+
+static void syscall_bench() {
+    struct proc *p            = curr_proc();
+    struct trapframe *tf      = p->trapframe;
+    struct trapframe saved_tf = *tf;
+    volatile uint64 sink      = 0;
+
+    tf->a7 = SYS_getppid;
+    BENCH("getppid (direct call)   ", SYSCALL_ROUNDS, 0, sink += sys_getppid());
+    BENCH("getppid (syscall)       ", SYSCALL_ROUNDS, 0, syscall());
+    *tf = saved_tf;
+
+    int code  = 0;
+    uint64 va = mm_mmap(p->mm, 0, PGSIZE, PTE_U | PTE_R | PTE_W, false);
+    // populate the lazy page.
+    if (va == 0 || copy_to_user(p->mm, va, (char *)&code, sizeof(code)) < 0)
+        panic("syscall_bench");
+    BENCH("store int (useraddr)    ", SYSCALL_ROUNDS, 0, {
+        acquire(&p->lock);
+        acquire(&p->mm->lock);
+        uint64 pa = useraddr(p->mm, va);
+        release(&p->mm->lock);
+        release(&p->lock);
+        *(int *)PA_TO_KVA(pa) = r;
+    });
+    BENCH("store int (copy_to_user)", SYSCALL_ROUNDS, 0, copy_to_user(p->mm, va, (char *)&r, sizeof(r)));
+    mm_munmap(p->mm, va, PGSIZE);
+}
+
+static void proc_bench(uint64 arg) {
+    string_bench();
+    yield_bench();
+    reap_bench();
+    launch_bench(INIT_PROC);
+    syscall_bench();
+    sched_share_bench();
+
+    printf("proc bench done, exec %s\n", INIT_PROC);
+    if (exec(INIT_PROC) < 0)
+        panic("exec %s", INIT_PROC);
+    intr_off();
+    usertrapret();
+}
+
+void proc_bench_init() {
+    if (kthread_create(proc_bench, 0) < 0)
+        panic("kthread_create");
+}
+#endif
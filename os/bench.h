@@ -0,0 +1,7 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// make PROC_BENCH=1 to run the process benchmarks at boot, see bench.c
+void proc_bench_init();
+
+#endif  // BENCH_H
@@ -6,7 +6,17 @@
 static int uart_inited = false;
 static void uart_putchar(int);
 
+// Transmit ring of user output, drained by uart_start() when the UART raises the
+//  THR-empty interrupt. Kernel output (consputc) still polls, so that it works
+//  in any context.
+#define UART_TX_BUF_SIZE 512
+// bytes written per THR-empty, half of the 16-byte FIFO: uart_putchar() on other harts
+//  may write to the FIFO at the same time.
+#define UART_TX_BURST 8
 static struct spinlock uart_tx_lock;
+static char uart_tx_buf[UART_TX_BUF_SIZE];
+static uint64 uart_tx_w;  // write next to uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE]
+static uint64 uart_tx_r;  // read next from uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]
 volatile int panicked = 0;
 
 #define BACKSPACE 0x100
@@ -42,6 +52,33 @@ static void uart_putchar(int ch) {
         intr_on();
 }
 
+// Move bytes from the transmit ring to the UART if it is idle.
+// Caller should hold uart_tx_lock, called from both top and bottom half.
+static void uart_start() {
+    if (uart_tx_r == uart_tx_w || (ReadReg(LSR) & LSR_TX_IDLE) == 0)
+        return;
+    for (int i = 0; i < UART_TX_BURST && uart_tx_r != uart_tx_w; i++) {
+        WriteReg(THR, uart_tx_buf[uart_tx_r++ % UART_TX_BUF_SIZE]);
+    }
+    MEMORY_FENCE();
+    // there is room in the ring, wake up uart_write().
+    wakeup(&uart_tx_r);
+}
+
+// Queue n bytes for transmission, sleep while the ring is full.
+static void uart_write(const char *s, int n) {
+    acquire(&uart_tx_lock);
+    for (int i = 0; i < n; i++) {
+        while (uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE) {
+            uart_start();
+            sleep(&uart_tx_r, &uart_tx_lock);
+        }
+        uart_tx_buf[uart_tx_w++ % UART_TX_BUF_SIZE] = s[i];
+    }
+    uart_start();
+    release(&uart_tx_lock);
+}
+
 void console_init() {
     assert(!uart_inited);
     spinlock_init(&uart_tx_lock, "uart_tx");
@@ -72,8 +109,8 @@ void console_init() {
     WriteReg(FCR, FCR_FIFO_ENABLE | FCR_FIFO_CLEAR);
     MEMORY_FENCE();
 
-    // enable receive interrupts.
-    WriteReg(IER, IER_RX_ENABLE);
+    // enable receive and transmit interrupts.
+    WriteReg(IER, IER_RX_ENABLE | IER_TX_ENABLE);
     MEMORY_FENCE();
     uart_inited = true;
 }
@@ -83,6 +120,8 @@ static void consintr(int c) {
 
     switch (c) {
         case C('P'):  // Print process list.
+            sched_print_stats();
+            kpgmgr_print_stats();
             break;
         case C('U'):  // Kill line.
             while (cons.e != cons.w && cons.buf[(cons.e - 1) % INPUT_BUF_SIZE] != '\n') {
@@ -130,6 +169,10 @@ static int uartgetc(void) {
 }
 
 void uart_intr() {
+    // reading ISR acknowledges a THR-empty interrupt.
+    ReadReg(ISR);
+    MEMORY_FENCE();
+
     while (1) {
         int c = uartgetc();
         if (c == -1)
@@ -137,6 +180,11 @@ void uart_intr() {
         // infof("uart: %c", c);
         consintr(c);
     }
+
+    // send buffered output.
+    acquire(&uart_tx_lock);
+    uart_start();
+    release(&uart_tx_lock);
 }
 
 int64 user_console_write(uint64 __user buf, int64 len) {
@@ -144,19 +192,17 @@ int64 user_console_write(uint64 __user buf, int64 len) {
         return -1;
 
     struct proc *p = curr_proc();
-    struct mm *mm;
-
-    acquire(&p->lock);
-    mm = p->mm;
-    acquire(&mm->lock);
-    release(&p->lock);
-
-    char kbuf[len];
-    copy_from_user(mm, kbuf, buf, len);
-    release(&mm->lock);
-
-    for (int64 i = 0; i < len; i++) {
-        uart_putchar(kbuf[i]);
+    char kbuf[64];
+
+    for (int64 off = 0; off < len; off += sizeof(kbuf)) {
+        int n = MIN(len - off, (int64)sizeof(kbuf));
+        if (copy_from_user(p->mm, kbuf, buf + off, n) < 0)
+            return off ? off : -1;
+        if (!uart_inited || panicked) {
+            for (int i = 0; i < n; i++) consputc(kbuf[i]);
+        } else {
+            uart_write(kbuf, n);
+        }
     }
     return len;
 }
@@ -193,17 +239,8 @@ int64 user_console_read(uint64 __user buf, int64 n) {
         // copy the input byte to the user-space buffer.
         cbuf = c;
 
-        struct proc *p = curr_proc();
-        acquire(&p->lock);
-        struct mm *mm = p->mm;
-        acquire(&mm->lock);
-        release(&p->lock);
-
-        if (copy_to_user(mm, (uint64)buf, &cbuf, 1) == -1) {
-            release(&mm->lock);
+        if (copy_to_user(curr_proc()->mm, (uint64)buf, &cbuf, 1) == -1)
             break;
-        }
-        release(&mm->lock);
 
         buf++;
         --n;
@@ -132,4 +132,4 @@ void mm_print(struct mm *mm) {
         vma = vma->next;
     }
     vm_print(mm->pgt);
-}
\ No newline at end of file
+}
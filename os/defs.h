@@ -49,4 +49,7 @@ extern char trampoline[];
 extern char uservec[];
 extern char userret[];
 
+// vdso.S
+extern char vdso_text[];
+
 #endif  // DEFS_H
\ No newline at end of file
@@ -2,89 +2,414 @@
 
 #include "defs.h"
 
-struct linklist {
-    struct linklist *next;
-};
+// Physical page allocator: a binary buddy allocator.
+//
+// Free memory is kept as blocks of 2^order contiguous pages, order in [0, KPAGE_MAX_ORDER].
+// Each block is naturally aligned to its size (relative to kmem.base, which is aligned to
+// the largest block size), so the buddy of a block is found by flipping bit `order` of its pfn.
+// Freeing a block merges it with its buddy as long as the buddy is a free block of the same order.
+//
+// The metadata of every page lives in kmem.pages[], not inside the free pages themselves.
 
 struct {
-    struct linklist *freelist;
+    struct page *pages;  // metadata of pages in [base, end)
+    uint64 npages;
+    uint64 __pa base;   // aligned down to the largest block size, pages below `start` are never freed.
+    uint64 __pa start;  // first page managed by the allocator
+    uint64 __pa end;
+    struct page free_area[KPAGE_MAX_ORDER + 1];  // sentinels of the circular free lists
+    uint64 nr_free[KPAGE_MAX_ORDER + 1];         // free blocks of each order
 } kmem;
 
 int kalloc_inited = 0;
 
-void freerange(void *kpgva_start, void *kpgva_end) {
-    assert(PGALIGNED((uint64)kpgva_start));
-    assert(PGALIGNED((uint64)kpgva_end));
-
-    for (uint64 p = (uint64)kpgva_end - PGSIZE; p >= (uint64)kpgva_start; p -= PGSIZE) kfreepage((void *)KVA_TO_PA(p));
-    kalloc_inited = 1;
+// Junk filling of allocated and freed memory, to catch dangling refs and uninitialized reads.
+// It costs full-page writes on every allocation, so only debug builds (LOG=debug/trace) enable it.
+// It can also be forced on with -D KALLOC_POISON.
+#if defined(LOG_LEVEL_DEBUG) || defined(LOG_LEVEL_TRACE)
+#define KALLOC_POISON
+#endif
+
+static inline void poison(void *__kva kva, int c, uint64 size) {
+#ifdef KALLOC_POISON
+    memset(kva, c, size);
+#endif
 }
 
 extern uint64 __kva kpage_allocator_base;
 extern uint64 __kva kpage_allocator_size;
 static spinlock_t kpagelock;
 
+static inline struct page *pa_to_page(uint64 __pa pa) {
+    return &kmem.pages[(pa - kmem.base) >> PGSHIFT];
+}
+
+static inline uint64 __pa page_to_pa(struct page *pg) {
+    return kmem.base + ((uint64)(pg - kmem.pages) << PGSHIFT);
+}
+
+static inline void free_list_add(int order, struct page *pg) {
+    struct page *head = &kmem.free_area[order];
+    pg->next          = head->next;
+    pg->prev          = head;
+    head->next->prev  = pg;
+    head->next        = pg;
+    pg->order         = order;
+    pg->free          = 1;
+    kmem.nr_free[order]++;
+}
+
+static inline void free_list_del(struct page *pg) {
+    pg->prev->next = pg->next;
+    pg->next->prev = pg->prev;
+    pg->next = pg->prev = NULL;
+    pg->free            = 0;
+    kmem.nr_free[pg->order]--;
+}
+
+void freerange(uint64 __pa pa_start, uint64 __pa pa_end) {
+    assert(PGALIGNED(pa_start));
+    assert(PGALIGNED(pa_end));
+
+    // hand out the largest naturally aligned blocks that fit.
+    uint64 pa = pa_start;
+    while (pa < pa_end) {
+        int order = KPAGE_MAX_ORDER;
+        while (order > 0 && (!IS_ALIGNED(pa - kmem.base, PGSIZE << order) || pa + (PGSIZE << order) > pa_end)) order--;
+        pa_to_page(pa)->order  = order;
+        pa_to_page(pa)->refcnt = 1;
+        kfreepages((void *)pa, order);
+        pa += PGSIZE << order;
+    }
+    kalloc_inited = 1;
+}
+
+static void kpage_cache_init();
+
 void kpgmgrinit() {
     spinlock_init(&kpagelock, "pageallocator");
+    kpage_cache_init();
     infof("init: base: %p, stop: %p", kpage_allocator_base, kpage_allocator_base + kpage_allocator_size);
-    freerange((void *)kpage_allocator_base, (void *)(kpage_allocator_base + kpage_allocator_size));
+
+    for (int i = 0; i <= KPAGE_MAX_ORDER; i++) {
+        kmem.free_area[i].next = kmem.free_area[i].prev = &kmem.free_area[i];
+        kmem.nr_free[i]                                 = 0;
+    }
+
+    kmem.base   = ROUNDDOWN_2N(KVA_TO_PA(kpage_allocator_base), PGSIZE << KPAGE_MAX_ORDER);
+    kmem.end    = KVA_TO_PA(kpage_allocator_base + kpage_allocator_size);
+    kmem.npages = (kmem.end - kmem.base) >> PGSHIFT;
+
+    // the metadata array takes the first pages of the allocator region.
+    uint64 meta_size = PGROUNDUP(kmem.npages * sizeof(struct page));
+    kmem.pages       = (struct page *)kpage_allocator_base;
+    memset(kmem.pages, 0, meta_size);
+    kmem.start = KVA_TO_PA(kpage_allocator_base) + meta_size;
+
+    infof("buddy: base %p, start %p, end %p, %d pages", kmem.base, kmem.start, kmem.end, (int)kmem.npages);
+    freerange(kmem.start, kmem.end);
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
-void kfreepage(void *__pa pa) {
-    struct linklist *l;
+static void check_block(uint64 __pa pa, int order) {
+    if (order < 0 || order > KPAGE_MAX_ORDER || !IS_ALIGNED(pa - kmem.base, PGSIZE << order) || !(kmem.start <= pa && pa + (PGSIZE << order) <= kmem.end))
+        panic("kfree: invalid page %p, order %d", pa, order);
+}
+
+// Take a block of 2^order pages from the free lists, kpagelock must be held.
+static struct page *buddy_alloc(int order) {
+    assert(holding(&kpagelock));
+
+    int cur = order;
+    while (cur <= KPAGE_MAX_ORDER && kmem.nr_free[cur] == 0) cur++;
+    if (cur > KPAGE_MAX_ORDER)
+        return NULL;
+
+    struct page *pg = kmem.free_area[cur].next;
+    free_list_del(pg);
+    // split: put the upper halves back until we reach the requested order.
+    while (cur > order) {
+        cur--;
+        free_list_add(cur, pg + (1ull << cur));
+    }
+    pg->order = order;
+    return pg;
+}
+
+// Give a block of 2^order pages back to the free lists, kpagelock must be held.
+static void buddy_free(struct page *pg, int order) {
+    assert(holding(&kpagelock));
+
+    if (pg->free)
+        panic("kfree: double free %p", page_to_pa(pg));
+    assert_str(pg->order == order, "kfree: page %p is allocated with order %d, freed with %d", page_to_pa(pg), pg->order, order);
+
+    uint64 pfn = pg - kmem.pages;
+    while (order < KPAGE_MAX_ORDER) {
+        uint64 buddy_pfn = pfn ^ (1ull << order);
+        if (buddy_pfn + (1ull << order) > kmem.npages)
+            break;
+        struct page *buddy = &kmem.pages[buddy_pfn];
+        if (!buddy->free || buddy->order != order)
+            break;
+        // merge with the buddy.
+        free_list_del(buddy);
+        pfn &= ~(1ull << order);
+        order++;
+    }
+    free_list_add(order, &kmem.pages[pfn]);
+}
+
+// Per-cpu page cache:
+//  Order-0 pages are allocated from and freed to a small per-cpu stack of pages.
+//  The stack refills from / drains to the buddy allocator KPAGE_CACHE_BATCH pages at a time,
+//  so the common kallocpage()/kfreepage() paths do not touch kpagelock at all.
+//  Each cache has a lock, only contended when another cpu runs out of memory and drains it.
+//  Lock order: cache lock -> kpagelock.
+
+#define KPAGE_CACHE_SIZE  (64)
+#define KPAGE_CACHE_BATCH (16)
+
+static struct kpage_cache {
+    spinlock_t lock;
+    int count;
+    struct page *pages[KPAGE_CACHE_SIZE];
+
+    // statistics, see kpgmgr_print_stats()
+    uint64 alloc_hit;
+    uint64 alloc_miss;  // cache was empty and refilled from the buddy allocator
+    uint64 free_hit;
+    uint64 free_miss;  // cache was full and drained to the buddy allocator
+} kpage_caches[NCPU];
+
+static void kpage_cache_init() {
+    for (int i = 0; i < NCPU; i++) spinlock_init(&kpage_caches[i].lock, "kpage_cache");
+}
+
+// Move up to KPAGE_CACHE_BATCH pages from the buddy allocator into cache.
+static void kpage_cache_refill(struct kpage_cache *cache) {
+    acquire(&kpagelock);
+    while (cache->count < KPAGE_CACHE_BATCH) {
+        struct page *pg = buddy_alloc(0);
+        if (pg == NULL)
+            break;
+        pg->cached                   = 1;
+        cache->pages[cache->count++] = pg;
+    }
+    release(&kpagelock);
+}
 
+// Move `n` pages from cache back to the buddy allocator.
+static void kpage_cache_drain(struct kpage_cache *cache, int n) {
     acquire(&kpagelock);
+    while (n-- > 0 && cache->count > 0) {
+        struct page *pg = cache->pages[--cache->count];
+        pg->cached      = 0;
+        buddy_free(pg, 0);
+    }
+    release(&kpagelock);
+}
+
+// Return the pages cached by all cpus to the buddy allocator, when it runs out of memory.
+static void kpage_cache_drain_all() {
+    for (int i = 0; i < NCPU; i++) {
+        struct kpage_cache *cache = &kpage_caches[i];
+        acquire(&cache->lock);
+        kpage_cache_drain(cache, cache->count);
+        release(&cache->lock);
+    }
+}
+
+// Drop one reference to pg, return the remaining references.
+static int page_put(struct page *pg) {
+    int ref = __sync_sub_and_fetch(&pg->refcnt, 1);
+    if (ref < 0)
+        panic("kfree: double free %p", page_to_pa(pg));
+    return ref;
+}
+
+// Take one more reference to the page (or block) at pa, see kfreepage.
+void kpage_ref(void *__pa pa) {
+    check_block((uint64)pa, 0);
+    struct page *pg = pa_to_page((uint64)pa);
+    int ref         = __sync_fetch_and_add(&pg->refcnt, 1);
+    assert_str(ref > 0, "kpage_ref on free page %p", pa);
+}
+
+// Return how many references the page (or block) at pa has.
+int kpage_refcnt(void *__pa pa) {
+    check_block((uint64)pa, 0);
+    return *(volatile int *)&pa_to_page((uint64)pa)->refcnt;
+}
 
-    uint64 __kva kvaddr = PA_TO_KVA(pa);
-    if (!PGALIGNED((uint64)pa) || !(kpage_allocator_base <= kvaddr && kvaddr < kpage_allocator_base + kpage_allocator_size))
-        panic("kfree: invalid page %p", pa);
+// Free a block of 2^order pages of physical memory pointed at by pa,
+// which normally should have been returned by a call to kallocpages(order).
+// (The exception is when initializing the allocator; see freerange above.)
+// If the block has been shared by kpage_ref, only drop one reference.
+void kfreepages(void *__pa pa, int order) {
+    check_block((uint64)pa, order);
+    if (page_put(pa_to_page((uint64)pa)) > 0)
+        return;
     // Fill with junk to catch dangling refs.
     if (kalloc_inited)
-        debugf("free : %p", pa);
-    memset((void *)kvaddr, 0xdd, PGSIZE);
-    l             = (struct linklist *)kvaddr;
-    l->next       = kmem.freelist;
-    kmem.freelist = l;
+        debugf("free : %p, order %d", pa, order);
+    poison((void *)PA_TO_KVA(pa), 0xdd, PGSIZE << order);
+
+    acquire(&kpagelock);
+    buddy_free(pa_to_page((uint64)pa), order);
+    release(&kpagelock);
+}
+
+void kfreepage(void *__pa pa) {
+    check_block((uint64)pa, 0);
+    debugf("free : %p", pa);
+
+    struct page *pg = pa_to_page((uint64)pa);
+    if (pg->free || pg->cached)
+        panic("kfree: double free %p", pa);
+    assert_str(pg->order == 0, "kfree: page %p is allocated with order %d, freed with 0", pa, pg->order);
+    if (page_put(pg) > 0)
+        return;
+    // Fill with junk to catch dangling refs.
+    poison((void *)PA_TO_KVA(pa), 0xdd, PGSIZE);
+
+    push_off();
+    struct kpage_cache *cache = &kpage_caches[cpuid()];
+    acquire(&cache->lock);
+    if (cache->count == KPAGE_CACHE_SIZE) {
+        cache->free_miss++;
+        kpage_cache_drain(cache, KPAGE_CACHE_BATCH);
+    } else {
+        cache->free_hit++;
+    }
+    pg->cached                   = 1;
+    cache->pages[cache->count++] = pg;
+    release(&cache->lock);
+    pop_off();
+}
 
+// Allocate 2^order physically contiguous pages, aligned to their size.
+// Returns the physical address of the first page.
+// Returns 0 if the memory cannot be allocated.
+void *__pa kallocpages(int order) {
+    assert(order >= 0 && order <= KPAGE_MAX_ORDER);
+
+    acquire(&kpagelock);
+    struct page *pg = buddy_alloc(order);
     release(&kpagelock);
+
+    if (pg == NULL) {
+        // pages held by the caches may be buddies of a larger free block.
+        kpage_cache_drain_all();
+
+        acquire(&kpagelock);
+        pg = buddy_alloc(order);
+        release(&kpagelock);
+        if (pg == NULL) {
+            warnf("out of memory, order %d", order);
+            return NULL;
+        }
+    }
+    pg->refcnt = 1;
+
+    uint64 __pa pa = page_to_pa(pg);
+    poison((void *)PA_TO_KVA(pa), 0xaf, PGSIZE << order);  // fill with junk
+    return (void *)pa;
 }
 
 // Allocate one 4096-byte page of physical memory.
-// Returns a pointer that the kernel can use.
+// Returns the physical address of the page.
 // Returns 0 if the memory cannot be allocated.
 void *__pa kallocpage() {
     uint64 ra;
     asm volatile("mv %0, ra\n" : "=r"(ra));
 
-    acquire(&kpagelock);
-    struct linklist *l;
-    l = kmem.freelist;
-    if (l) {
-        kmem.freelist = l->next;
-        memset((char *)l, 0xaf, PGSIZE);  // fill with junk
+    push_off();
+    struct kpage_cache *cache = &kpage_caches[cpuid()];
+    acquire(&cache->lock);
+    if (cache->count == 0) {
+        cache->alloc_miss++;
+        kpage_cache_refill(cache);
+        if (cache->count == 0) {
+            // the rest may sit in other cpus' caches.
+            release(&cache->lock);
+            kpage_cache_drain_all();
+            acquire(&cache->lock);
+            kpage_cache_refill(cache);
+        }
+    } else {
+        cache->alloc_hit++;
+    }
+    struct page *pg = NULL;
+    if (cache->count > 0) {
+        pg         = cache->pages[--cache->count];
+        pg->cached = 0;
+        pg->refcnt = 1;
+    }
+    release(&cache->lock);
+    pop_off();
+
+    if (pg == NULL) {
+        warnf("out of memory");
+        return NULL;
+    }
+
+    uint64 __pa pa = page_to_pa(pg);
+    poison((void *)PA_TO_KVA(pa), 0xaf, PGSIZE);  // fill with junk
+    debugf("alloc: %p, by %p", pa, ra);
+    return (void *)pa;
+}
+
+// Allocate one page filled with zeros.
+// Callers who need a zeroed page should use this, instead of clearing the page again.
+void *__pa kallocpage_zeroed() {
+    void *__pa pa = kallocpage();
+    if (pa)
+        clear_page((void *)PA_TO_KVA(pa));
+    return pa;
+}
+
+// Print page allocator counters, triggered by Ctrl-P on the console.
+void kpgmgr_print_stats() {
+    printf("free blocks:");
+    for (int i = 0; i <= KPAGE_MAX_ORDER; i++) printf(" %d", (int)kmem.nr_free[i]);
+    printf("\ncpu  cached  alloc_hit  alloc_miss  free_hit  free_miss\n");
+    for (int i = 0; i < NCPU; i++) {
+        struct kpage_cache *cache = &kpage_caches[i];
+        printf("%d    %d      %d      %d      %d      %d\n",
+               i,
+               cache->count,
+               (int)cache->alloc_hit,
+               (int)cache->alloc_miss,
+               (int)cache->free_hit,
+               (int)cache->free_miss);
     }
-    debugf("alloc: %p, by %p", l, ra);
-    release(&kpagelock);
-    return (void *)KVA_TO_PA((uint64)l);
 }
 
 // Object Allocator
+//
+// Free objects are found in O(1):
+//  - each cpu keeps a small cache of free objects (alloc->caches[cpuid()]), used without alloc->lock.
+//  - the shared pool is a free list embedded in the free objects themselves,
+//    plus a bump index for objects that have never been allocated.
+// The bitmap records which objects are handed out to callers, it is only used to catch double frees,
+// and is updated with atomic instructions so that the per-cpu fast paths need no lock.
+
 static uint64 allocator_mapped_va = KERNEL_ALLOCATOR_BASE;
 
-static inline void bit_set(uint8 *bitmap, uint64 index) {
-    bitmap[index / 8] |= (1 << (index % 8));
-}
+struct free_object {
+    struct free_object *next;
+};
 
-static inline void bit_clear(uint8 *bitmap, uint64 index) {
-    bitmap[index / 8] &= ~(1 << (index % 8));
+// Set bit `index`, return whether it was set before.
+static inline int bit_test_and_set(uint64 *bitmap, uint64 index) {
+    uint64 mask = 1ull << (index % 64);
+    return (__sync_fetch_and_or(&bitmap[index / 64], mask) & mask) != 0;
 }
 
-static inline int is_bit_set(const uint8 *bitmap, uint64 index) {
-    return bitmap[index / 8] & (1 << (index % 8));
+// Clear bit `index`, return whether it was set before.
+static inline int bit_test_and_clear(uint64 *bitmap, uint64 index) {
+    uint64 mask = 1ull << (index % 64);
+    return (__sync_fetch_and_and(&bitmap[index / 64], ~mask) & mask) != 0;
 }
 
 void allocator_init(struct allocator *alloc, char *name, uint64 object_size, uint64 count) {
@@ -96,8 +421,6 @@ void allocator_init(struct allocator *alloc, char *name, uint64 object_size, uin
     alloc->object_size_aligned = ROUNDUP_2N(object_size, 16);
     alloc->max_count           = count;
 
-    assert(count <= PGSIZE * 8);
-
     // calculate how many pages do we need
     uint64 total_size = alloc->object_size_aligned * alloc->max_count;
     total_size        = PGROUNDUP(total_size);
@@ -116,65 +439,131 @@ void allocator_init(struct allocator *alloc, char *name, uint64 object_size, uin
         void *__pa pg = kallocpage();
         if (pg == NULL)
             panic("kallocpage");
-        memset((void *)PA_TO_KVA(pg), 0xf8, PGSIZE);
+        poison((void *)PA_TO_KVA(pg), 0xf8, PGSIZE);
         kvmmap(kernel_pagetable, va, (uint64)pg, PGSIZE, PTE_A | PTE_D | PTE_R | PTE_W);
     }
     sfence_vma();
 
-    // allocate the bitmap page:
-    void *__pa pg = kallocpage();
+    // allocate the bitmap, one bit per object, all objects are free.
+    uint64 bitmap_size = PGROUNDUP(ROUNDUP_2N(count, 64) / 8);
+    void *__pa pg      = kallocpages(kpage_size_to_order(bitmap_size));
     assert(pg);
-    alloc->bitmap = (uint8 *)PA_TO_KVA(pg);
+    alloc->bitmap = (uint64 *)PA_TO_KVA(pg);
+    memset(alloc->bitmap, 0, bitmap_size);
 
-    // mark all bits are allocated
-    memset(alloc->bitmap, 0xff, PGSIZE);
+    // allocate the per-cpu caches
+    assert(sizeof(struct allocator_cache) * NCPU <= PGSIZE);
+    pg = kallocpage_zeroed();
+    assert(pg);
+    alloc->caches = (struct allocator_cache *)PA_TO_KVA(pg);
+    for (int i = 0; i < NCPU; i++) spinlock_init(&alloc->caches[i].lock, "allocator_cache");
 
-    // mark [count] objects are freed
-    for (uint64 i = 0; i < alloc->max_count; i++) {
-        bit_clear(alloc->bitmap, i);
-    }
+    alloc->freelist        = NULL;
+    alloc->never_used      = 0;
     alloc->available_count = alloc->max_count;
     alloc->allocated_count = 0;
 }
 
+// Move up to ALLOCATOR_CACHE_BATCH objects from the shared pool into cache.
+static void allocator_refill(struct allocator *alloc, struct allocator_cache *cache) {
+    acquire(&alloc->lock);
+    while (cache->count < ALLOCATOR_CACHE_BATCH && alloc->available_count > 0) {
+        void *obj;
+        if (alloc->freelist) {
+            obj             = alloc->freelist;
+            alloc->freelist = alloc->freelist->next;
+        } else {
+            assert(alloc->never_used < alloc->max_count);
+            obj = (void *)(alloc->pool_base + alloc->never_used * alloc->object_size_aligned);
+            alloc->never_used++;
+        }
+        alloc->available_count--;
+        alloc->allocated_count++;
+        cache->objs[cache->count++] = obj;
+    }
+    assert(alloc->allocated_count + alloc->available_count == alloc->max_count);
+    release(&alloc->lock);
+}
+
+// Move `n` objects from cache back to the shared pool.
+static void allocator_drain(struct allocator *alloc, struct allocator_cache *cache, int n) {
+    acquire(&alloc->lock);
+    while (n-- > 0 && cache->count > 0) {
+        struct free_object *obj = cache->objs[--cache->count];
+        obj->next               = alloc->freelist;
+        alloc->freelist         = obj;
+        alloc->available_count++;
+        alloc->allocated_count--;
+    }
+    assert(alloc->allocated_count + alloc->available_count == alloc->max_count);
+    release(&alloc->lock);
+}
+
+// Return the objects cached by all cpus to the shared pool, when it is empty.
+static void allocator_drain_all(struct allocator *alloc) {
+    for (int i = 0; i < NCPU; i++) {
+        struct allocator_cache *cache = &alloc->caches[i];
+        acquire(&cache->lock);
+        allocator_drain(alloc, cache, cache->count);
+        release(&cache->lock);
+    }
+}
+
+// Return NULL if all objects are allocated.
 void *kalloc(struct allocator *alloc) {
     assert(alloc);
-    acquire(&alloc->lock);
-    if (alloc->available_count == 0)
-        panic("unavailable");
-    alloc->available_count--;
-    for (uint64 i = 0; i < alloc->max_count; i++) {
-        if (!is_bit_set(alloc->bitmap, i)) {
-            bit_set(alloc->bitmap, i);
-            alloc->allocated_count++;
-            uint8 *ret = (uint8 *)(alloc->pool_base + (i * alloc->object_size_aligned));
-            assert(alloc->allocated_count + alloc->available_count == alloc->max_count);
-
-            memset(ret, 0xf9, alloc->object_size_aligned);
-            tracef("kalloc(%s) returns %p", alloc->name, ret);
-            release(&alloc->lock);
-            return ret;
+
+    push_off();
+    struct allocator_cache *cache = &alloc->caches[cpuid()];
+    acquire(&cache->lock);
+    if (cache->count == 0) {
+        allocator_refill(alloc, cache);
+        if (cache->count == 0) {
+            // the rest may sit in other cpus' caches.
+            release(&cache->lock);
+            allocator_drain_all(alloc);
+            acquire(&cache->lock);
+            allocator_refill(alloc, cache);
+        }
+        if (cache->count == 0) {
+            release(&cache->lock);
+            pop_off();
+            warnf("kalloc(%s): out of objects", alloc->name);
+            return NULL;
         }
     }
-    panic("should not happen");
+    uint8 *ret = cache->objs[--cache->count];
+    release(&cache->lock);
+    pop_off();
+
+    uint64 index = ((uint64)ret - alloc->pool_base) / alloc->object_size_aligned;
+    if (bit_test_and_set(alloc->bitmap, index))
+        panic("kalloc(%s): %p is already allocated", alloc->name, ret);
+
+    poison(ret, 0xf9, alloc->object_size_aligned);
+    tracef("kalloc(%s) returns %p", alloc->name, ret);
+    return ret;
 }
 
 void kfree(struct allocator *alloc, void *obj) {
     if (obj == NULL)
         return;
-    acquire(&alloc->lock);
     assert(alloc);
     assert(alloc->pool_base <= (uint64)obj && (uint64)obj < alloc->pool_end);
+    assert(((uint64)obj - alloc->pool_base) % alloc->object_size_aligned == 0);
 
     uint64 index = ((uint64)obj - alloc->pool_base) / alloc->object_size_aligned;
-    if (!is_bit_set(alloc->bitmap, index)) {
+    if (!bit_test_and_clear(alloc->bitmap, index)) {
         panic("double free: %p", obj);
     }
-
-    bit_clear(alloc->bitmap, index);
-    alloc->allocated_count--;
-    alloc->available_count++;
-    assert(alloc->allocated_count + alloc->available_count == alloc->max_count);
-    memset(obj, 0xfa, alloc->object_size_aligned);
-    release(&alloc->lock);
-}
\ No newline at end of file
+    poison(obj, 0xfa, alloc->object_size_aligned);
+
+    push_off();
+    struct allocator_cache *cache = &alloc->caches[cpuid()];
+    acquire(&cache->lock);
+    if (cache->count == ALLOCATOR_CACHE_SIZE)
+        allocator_drain(alloc, cache, ALLOCATOR_CACHE_BATCH);
+    cache->objs[cache->count++] = obj;
+    release(&cache->lock);
+    pop_off();
+}
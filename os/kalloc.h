@@ -3,12 +3,51 @@
 
 #include "vm.h"
 
+// Physical Page Allocator:
+
+// The largest block is 2^KPAGE_MAX_ORDER pages, i.e. 2 MiB, which is a level-1 huge page.
+#define KPAGE_MAX_ORDER (9)
+
+// Metadata of a physical page, see kalloc.c
+struct page {
+    struct page *next;  // free list link, only valid for the first page of a free block
+    struct page *prev;
+    uint8 order;   // order of the block starting at this page
+    uint8 free;    // whether this page starts a free block
+    uint8 cached;  // whether this page sits in a per-cpu page cache
+    int refcnt;    // references to an allocated block, e.g. copy-on-write mappings
+};
+
 void kpgmgrinit();
 void kfreepage(void *pa);
 void *__pa kallocpage();
+void *__pa kallocpage_zeroed();
+void kfreepages(void *__pa pa, int order);
+void *__pa kallocpages(int order);
+void kpage_ref(void *__pa pa);
+int kpage_refcnt(void *__pa pa);
+void kpgmgr_print_stats();
+
+// The smallest order whose block holds `size` bytes.
+static inline int kpage_size_to_order(uint64 size) {
+    int order = 0;
+    while ((PGSIZE << order) < size) order++;
+    return order;
+}
 
 // Object Allocator:
 
+#define ALLOCATOR_CACHE_SIZE  (16)
+#define ALLOCATOR_CACHE_BATCH (8)
+
+// per-cpu cache of free objects
+// lock is only contended when another cpu runs out of objects and drains this cache.
+struct allocator_cache {
+    spinlock_t lock;
+    int count;
+    void *objs[ALLOCATOR_CACHE_SIZE];
+};
+
 typedef struct allocator {
     char * name;
     spinlock_t lock;
@@ -16,11 +55,16 @@ typedef struct allocator {
     uint64 __kva pool_base;
     uint64 __kva pool_end;
 
-    uint8* bitmap;
+    uint64* bitmap;  // bit set: object is allocated
+
+    struct allocator_cache *caches;  // NCPU entries
+    struct free_object *freelist;    // freed objects in the shared pool, protected by lock
+    uint64 never_used;               // objects at index >= never_used have never been allocated
     
     uint64 object_size;
     uint64 object_size_aligned;
 
+    // counts of the shared pool, objects in per-cpu caches are counted as allocated.
     uint64 allocated_count;
     uint64 available_count;
     uint64 max_count;
@@ -156,7 +156,7 @@ void kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm) {
         if (!(kpgtbl[vpn2] & PTE_V)) {
             // kpgtbl[vpn2] is not a valid PTE, allocate the level 1 pagetable.
             uint64 __kva newpg = allockernelpage();
-            memset((void *)newpg, 0, PGSIZE);
+            clear_page((void *)newpg);
             pgtbl_level1 = (pagetable_t)newpg;
             kpgtbl[vpn2] = MAKE_PTE(KVA_TO_PA(newpg), PTE_G);
         } else {
@@ -179,7 +179,7 @@ void kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm) {
                 continue;
             }
             uint64 __kva newpg = allockernelpage();
-            memset((void *)newpg, 0, PGSIZE);
+            clear_page((void *)newpg);
             pgtbl_level0       = (pagetable_t)newpg;
             pgtbl_level1[vpn1] = MAKE_PTE(KVA_TO_PA(newpg), PTE_G);
         } else {
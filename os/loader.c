@@ -47,46 +47,56 @@ int load_user_elf(struct user_app *app, struct proc *p)
 		if (phdr->p_flags & PF_X)
 			pte_perm |= PTE_X;
 
-		struct vma *vma = mm_create_vma(p->mm);
-		vma->vm_start = PGROUNDDOWN(phdr->p_vaddr); // The ELF requests this phdr loaded to p_vaddr;
-		vma->vm_end = PGROUNDUP(vma->vm_start + phdr->p_memsz);
-		vma->pte_flags = pte_perm;
-
-		if (mm_mappages(vma)) {
-			panic("mm_mappages");
-		}
+		// [vm_start, file_end) holds bytes from the ELF file, loaded now.
+		// [file_end, mem_end) is pure .bss, zero-filled lazily on first access.
+		uint64 vm_start = PGROUNDDOWN(phdr->p_vaddr); // The ELF requests this phdr loaded to p_vaddr;
+		uint64 file_end = PGROUNDUP(phdr->p_vaddr + phdr->p_filesz);
+		uint64 mem_end = PGROUNDUP(phdr->p_vaddr + phdr->p_memsz);
 
 		int64 file_off = 0;
 		uint64 file_remains = phdr->p_filesz;
 
-		for (uint64 va = vma->vm_start; va < vma->vm_end; va += PGSIZE) {
-			void *__kva pa = (void *)PA_TO_KVA(walkaddr(p->mm, va));
-			void *src = (void *)(app->elf_address + phdr->p_offset + file_off);
+		if (file_end > vm_start) {
+			struct vma *vma = mm_create_vma(p->mm);
+			if (vma == NULL)
+				return -1;
+			vma->vm_start = vm_start;
+			vma->vm_end = file_end;
+			vma->pte_flags = pte_perm;
 
-			uint64 copy_size = MIN(file_remains, PGSIZE);
-			memmove(pa, src, copy_size);
+			if (mm_mappages(vma)) {
+				panic("mm_mappages");
+			}
 
-			if (copy_size < PGSIZE) {
-				// clear remaining bytes
-				memset(pa + copy_size, 0, PGSIZE - copy_size);
+			for (uint64 va = vma->vm_start; va < vma->vm_end; va += PGSIZE) {
+				void *__kva pa = (void *)PA_TO_KVA(walkaddr(p->mm, va));
+				void *src = (void *)(app->elf_address + phdr->p_offset + file_off);
+
+				uint64 copy_size = MIN(file_remains, PGSIZE);
+				if (copy_size == PGSIZE && IS_ALIGNED((uint64)src, PGSIZE))
+					copy_page(pa, src);
+				else
+					memmove(pa, src, copy_size);
+
+				if (copy_size < PGSIZE) {
+					// clear remaining bytes, including the head of .bss
+					memset(pa + copy_size, 0, PGSIZE - copy_size);
+				}
+				file_off += copy_size;
+				file_remains -= copy_size;
 			}
-			file_off += copy_size;
-			file_remains -= copy_size;
 		}
 
-		if (phdr->p_memsz > phdr->p_filesz) {
-			// ELF requests larger memory than filesz
-			// 	these are .bss segment, clear it to zero.
-
-			uint64 bss_start = phdr->p_vaddr + phdr->p_filesz;
-			uint64 bss_end = phdr->p_vaddr + phdr->p_memsz;
-
-			for (uint64 va = bss_start; va < bss_end; va = PGROUNDDOWN(va) + PGSIZE) {
-				// set [va, page boundary of ba) to zero
-				uint64 page_off = va - PGROUNDDOWN(va);
-				uint64 clear_size = PGROUNDUP(va) - va;
-				void *__kva pa = (void *)PA_TO_KVA(walkaddr(p->mm, PGROUNDDOWN(va)));
-				memset(pa + page_off, 0, clear_size);
+		if (mem_end > file_end) {
+			struct vma *bss = mm_create_vma(p->mm);
+			if (bss == NULL)
+				return -1;
+			bss->vm_start = file_end;
+			bss->vm_end = mem_end;
+			bss->pte_flags = pte_perm;
+			bss->vm_flags = VMA_LAZY;
+			if (mm_mappages(bss)) {
+				panic("mm_mappages");
 			}
 		}
 
@@ -95,24 +105,26 @@ int load_user_elf(struct user_app *app, struct proc *p)
 	}
 
 	p->vma_brk = mm_create_vma(p->mm);
+	if (p->vma_brk == NULL)
+		return -1;
 	p->vma_brk->vm_start = max_va_end;
 	p->vma_brk->vm_end = p->vma_brk->vm_start;
 	p->vma_brk->pte_flags = PTE_R | PTE_W | PTE_U;
+	p->vma_brk->vm_flags = VMA_LAZY;
 	mm_mappages(p->vma_brk);
+	p->program_brk = max_va_end;
 
 	p->vma_ustack = mm_create_vma(p->mm);
+	if (p->vma_ustack == NULL)
+		return -1;
 	p->vma_ustack->vm_start = USTACK_START - USTACK_SIZE;
 	p->vma_ustack->vm_end = USTACK_START;
 	p->vma_ustack->pte_flags = PTE_R | PTE_W | PTE_U;
+	p->vma_ustack->vm_flags = VMA_LAZY;
 	mm_mappages(p->vma_ustack);
 
 	// vm_print(p->mm->pgt);
 
-	for (uint64 va = p->vma_ustack->vm_start; va < p->vma_ustack->vm_end; va += PGSIZE) {
-		void *__kva pa = (void *)PA_TO_KVA(walkaddr(p->mm, va));
-		memset(pa, 0, PGSIZE);
-	}
-
 	// setup trapframe
 	p->trapframe->sp = p->vma_ustack->vm_end;
 	p->trapframe->epc = ehdr->e_entry;
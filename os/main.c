@@ -1,3 +1,4 @@
+#include "bench.h"
 #include "console.h"
 #include "debug.h"
 #include "defs.h"
@@ -193,9 +194,15 @@ static void bootcpu_init() {
     uvm_init();
     proc_init();
     loader_init();
+#ifdef PROC_BENCH
+    // the benchmarks start the init proc when they are done.
+    proc_bench_init();
+#else
     load_init_app();
+#endif
 
     timer_init();
+    ipi_init();
     plicinithart();
 
     MEMORY_FENCE();
@@ -215,6 +222,7 @@ static void secondarycpu_init() {
 
     trap_init();
     timer_init();
+    ipi_init();
     plicinithart();
 
     infof("start scheduler!");
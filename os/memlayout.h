@@ -70,5 +70,17 @@
 #define TRAMPOLINE (USER_TOP - PGSIZE)
 #define TRAPFRAME  (TRAMPOLINE - PGSIZE)
 
+// read-only pages shared by every process, see vdso.S.
+// gettimeofday() is at VDSO_TEXT, the clock calibration at VDSO_DATA.
+#define VDSO_DATA (TRAPFRAME - PGSIZE)
+#define VDSO_TEXT (VDSO_DATA - PGSIZE)
+
+// the submission/completion ring of io_uring_setup(), see uring.h
+#define URING (VDSO_TEXT - PGSIZE)
+
+// anonymous mmap() regions are placed in [MMAP_BASE, MMAP_END)
+#define MMAP_BASE (0x1000000000L)
+#define MMAP_END  (0x3000000000L)
+
 
 #endif  // MEMLAYOUT_H
\ No newline at end of file
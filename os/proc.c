@@ -5,6 +5,7 @@
 #include "trap.h"
 #include "kalloc.h"
 #include "loader.h"
+#include "uring.h"
 
 struct proc *pool[NPROC];
 static struct proc *init_proc;
@@ -13,7 +14,14 @@ static allocator_t proc_allocator;
 static spinlock_t pid_lock;
 static spinlock_t wait_lock;
 
+// stack of UNUSED pool indices, allocproc pops and freeproc pushes.
+static spinlock_t free_slot_lock;
+static int free_slots[NPROC];
+static int nr_free_slots;
+
 extern void sched_init();
+static void waitq_init();
+static void sleep_timer_expire(void *arg);
 
 // initialize the proc table at boot time.
 void proc_init() {
@@ -24,6 +32,8 @@ void proc_init() {
 
     spinlock_init(&pid_lock, "pid");
     spinlock_init(&wait_lock, "wait");
+    spinlock_init(&free_slot_lock, "free_slot");
+    waitq_init();
 
     allocator_init(&proc_allocator, "proc", sizeof(struct proc), NPROC);
     struct proc *p;
@@ -32,22 +42,28 @@ void proc_init() {
 
     for (int i = 0; i < NPROC; i++) {
         p = kalloc(&proc_allocator);
+        assert(p);
         memset(p, 0, sizeof(*p));
         spinlock_init(&p->lock, "proc");
+        timer_setup(&p->sleep_timer, sleep_timer_expire, p);
         p->index = i;
         p->state = UNUSED;
 
         p->kstack = proc_kstack;
-        for (uint64 va = proc_kstack; va < proc_kstack + KERNEL_STACK_SIZE; va += PGSIZE) {
-            uint64 __pa newpg = (uint64)kallocpage();
-            kvmmap(kernel_pagetable, va, newpg, PGSIZE, PTE_A | PTE_D | PTE_R | PTE_W);
-        }
+        // kernel stack is physically contiguous, map it at once.
+        uint64 __pa kstack_pa = (uint64)kallocpages(kpage_size_to_order(KERNEL_STACK_SIZE));
+        if (!kstack_pa)
+            panic("kallocpages");
+        kvmmap(kernel_pagetable, proc_kstack, kstack_pa, KERNEL_STACK_SIZE, PTE_A | PTE_D | PTE_R | PTE_W);
         sfence_vma();
         proc_kstack += 2 * KERNEL_STACK_SIZE;
 
         p->trapframe = (struct trapframe *)PA_TO_KVA(kallocpage());
         pool[i]      = p;
+        // pool[0] is handed out first, for init_proc.
+        free_slots[NPROC - 1 - i] = i;
     }
+    nr_free_slots = NPROC;
     sched_init();
 
     init_proc = pool[0];
@@ -69,22 +85,23 @@ static int allocpid() {
     usertrapret();
 }
 
-// Look in the process table for an UNUSED proc.
+// Pop an UNUSED proc from the free slot stack.
 // If found, initialize state required to run in the kernel.
 // If there are no free procs, or a memory allocation fails, return 0.
 struct proc *allocproc() {
     struct proc *p;
-    for (int i = 0; i < NPROC; i++) {
-        p = pool[i];
-        acquire(&p->lock);
-        if (p->state == UNUSED) {
-            goto found;
-        }
-        release(&p->lock);
+
+    acquire(&free_slot_lock);
+    if (nr_free_slots == 0) {
+        release(&free_slot_lock);
+        return 0;
     }
-    return 0;
+    p = pool[free_slots[--nr_free_slots]];
+    release(&free_slot_lock);
+
+    acquire(&p->lock);
+    assert(p->state == UNUSED);
 
-found:
     // initialize a proc
     tracef("init proc %p", p);
     p->pid   = allocpid();
@@ -92,20 +109,29 @@ found:
     p->mm    = mm_create();
     if (!p->mm)
         panic("mm");
-    p->vma_ustack = NULL;
-    p->vma_brk    = NULL;
+    p->vma_ustack  = NULL;
+    p->vma_brk     = NULL;
+    p->program_brk = 0;
     // only allocate trampoline and trapframe here.
     p->vma_trampoline = mm_mappagesat(p->mm, TRAMPOLINE, KIVA_TO_PA(trampoline), PTE_A | PTE_R | PTE_X, false);
-    uint64 __pa tf    = (uint64)kallocpage();
+    uint64 __pa tf    = (uint64)kallocpage_zeroed();
     if (!tf)
         panic("tf");
     p->vma_trapframe = mm_mappagesat(p->mm, TRAPFRAME, tf, PTE_A | PTE_D | PTE_R | PTE_W | PTE_X, false);
     p->trapframe     = (struct trapframe *)PA_TO_KVA(tf);
+    // vdso pages are shared by all processes.
+    p->vma_vdso_text = mm_mappagesat(p->mm, VDSO_TEXT, KIVA_TO_PA(vdso_text), PTE_A | PTE_R | PTE_X | PTE_U, false);
+    p->vma_vdso_data = mm_mappagesat(p->mm, VDSO_DATA, vdso_data_pa(), PTE_A | PTE_R | PTE_U, false);
+    if (!p->vma_trampoline || !p->vma_trapframe || !p->vma_vdso_text || !p->vma_vdso_data)
+        panic("mappagesat");
+    p->vma_uring     = NULL;
+    p->uring         = NULL;
     p->parent        = NULL;
+    p->last_cpu      = -1;
     p->exit_code     = 0;
+    sched_proc_init(p, NULL);
     memset(&p->context, 0, sizeof(p->context));
     memset((void *)p->kstack, 0, KERNEL_STACK_SIZE);
-    memset((void *)p->trapframe, 0, PGSIZE);
     p->context.ra = (uint64)first_sched_ret;
     p->context.sp = p->kstack + KERNEL_STACK_SIZE;
 
@@ -122,53 +148,215 @@ static void freeproc(struct proc *p) {
     p->sleep_chan = NULL;
     p->killed     = 0;
     p->parent     = NULL;
-
-    freevma(p->vma_trampoline, false);
-    freevma(p->vma_trapframe, true);
+    p->children   = NULL;
+    p->zombies    = NULL;
+    p->last_cpu   = -1;
+
+    mm_unmappagesat(p->vma_trampoline, false);
+    mm_unmappagesat(p->vma_trapframe, true);
+    mm_unmappagesat(p->vma_vdso_text, false);
+    mm_unmappagesat(p->vma_vdso_data, false);
+    uring_free(p);
     p->vma_trampoline = NULL;
     p->vma_trapframe  = NULL;
+    p->vma_vdso_text  = NULL;
+    p->vma_vdso_data  = NULL;
     mm_free(p->mm);
     p->vma_brk    = NULL;
     p->vma_ustack = NULL;
+
+    acquire(&free_slot_lock);
+    free_slots[nr_free_slots++] = p->index;
+    release(&free_slot_lock);
 }
 
-void sleep(void *chan, spinlock_t *lk) {
-    struct proc *p = curr_proc();
+// Wait channels are hashed into buckets of sleeping processes,
+// so wakeup(chan) only visits the sleepers whose channel falls into the same bucket.
+// Lock order: the caller's lk -> bucket lock -> p->lock.
+#define WAITQ_HASH_BITS 6
+#define WAITQ_HASH_SIZE (1 << WAITQ_HASH_BITS)
+
+struct waitq {
+    spinlock_t lock;
+    struct proc *head, *tail;  // sleepers in FIFO order
+};
+static struct waitq waitqs[WAITQ_HASH_SIZE];
+
+static void waitq_init() {
+    for (int i = 0; i < WAITQ_HASH_SIZE; i++)
+        spinlock_init(&waitqs[i].lock, "waitq");
+}
+
+static struct waitq *waitq_of(void *chan) {
+    return &waitqs[((uint64)chan * 0x9E3779B97F4A7C15ULL) >> (64 - WAITQ_HASH_BITS)];
+}
+
+// Caller should hold wq->lock.
+static void waitq_remove(struct waitq *wq, struct proc *p) {
+    if (p->sleep_prev)
+        p->sleep_prev->sleep_next = p->sleep_next;
+    else
+        wq->head = p->sleep_next;
+    if (p->sleep_next)
+        p->sleep_next->sleep_prev = p->sleep_prev;
+    else
+        wq->tail = p->sleep_prev;
+    p->sleep_next = p->sleep_prev = NULL;
+}
+
+// Wake up p if its sleep_timeout() is still sleeping, called by the timer wheel.
+static void sleep_timer_expire(void *arg) {
+    struct proc *p = arg;
+    // p can not leave sleep_timeout() before we return, see timer_del().
+    void *chan = *(void *volatile *)&p->sleep_chan;
+    if (chan == NULL)
+        return;
+
+    struct waitq *wq = waitq_of(chan);
+    acquire(&wq->lock);
+    acquire(&p->lock);
+    if (p->state == SLEEPING && p->sleep_chan == chan) {
+        waitq_remove(wq, p);
+        p->sleep_timed_out = 1;
+        p->state           = RUNNABLE;
+        add_task(p);
+    }
+    release(&p->lock);
+    release(&wq->lock);
+}
+
+// Sleep on chan, and give up after ticks if ticks != 0.
+// lk may be NULL if only the timer wakes up chan.
+static void do_sleep(void *chan, spinlock_t *lk, uint64 ticks) {
+    struct proc *p    = curr_proc();
+    struct waitq *wq  = waitq_of(chan);
 
     // Must acquire p->lock in order to
     // change p->state and then call sched.
-    // Once we hold p->lock, we can be
+    // Once we hold wq->lock, we can be
     // guaranteed that we won't miss any wakeup
-    // (wakeup locks p->lock),
+    // (wakeup locks wq->lock),
     // so it's okay to release lk.
 
+    acquire(&wq->lock);
     acquire(&p->lock);  // DOC: sleeplock1
-    release(lk);
+    if (lk)
+        release(lk);
 
     // Go to sleep.
-    p->sleep_chan = chan;
-    p->state      = SLEEPING;
+    p->sleep_chan      = chan;
+    p->state           = SLEEPING;
+    p->sleep_timed_out = 0;
+    p->sleep_prev      = wq->tail;
+    p->sleep_next      = NULL;
+    if (wq->tail)
+        wq->tail->sleep_next = p;
+    else
+        wq->head = p;
+    wq->tail = p;
+    if (ticks)
+        timer_add(&p->sleep_timer, get_ticks() + ticks);
+    release(&wq->lock);
 
     sched();
 
     // p get waking up, Tidy up.
     p->sleep_chan = 0;
 
-    // Reacquire original lock.
     release(&p->lock);
-    acquire(lk);
+    if (ticks)
+        timer_del(&p->sleep_timer);
+
+    // Reacquire original lock.
+    if (lk)
+        acquire(lk);
 }
 
-void wakeup(void *chan) {
-    for (int i = 0; i < NPROC; i++) {
-        struct proc *p = pool[i];
+void sleep(void *chan, spinlock_t *lk) {
+    do_sleep(chan, lk, 0);
+}
+
+// Like sleep(), but wake up by itself after ticks (at least 1).
+// Return -1 if timed out, 0 if woken up by wakeup().
+int sleep_timeout(void *chan, spinlock_t *lk, uint64 ticks) {
+    do_sleep(chan, lk, MAX(ticks, 1));
+    return curr_proc()->sleep_timed_out ? -1 : 0;
+}
+
+// Block the current process for ticks, see get_ticks().
+void sleep_ticks(uint64 ticks) {
+    struct proc *p  = curr_proc();
+    uint64 deadline = get_ticks() + ticks;
+
+    // nobody else sleeps on or wakes up &p->sleep_timer, the waitq bucket lock is enough.
+    uint64 now;
+    while ((now = get_ticks()) < deadline && !p->killed)
+        do_sleep(&p->sleep_timer, NULL, deadline - now);
+}
+
+// Wake up at most n processes sleeping on chan, in the order they went to sleep.
+static void wakeup_n(void *chan, int n) {
+    struct waitq *wq = waitq_of(chan);
+
+    acquire(&wq->lock);
+    struct proc *p = wq->head, *next;
+    for (; p && n > 0; p = next) {
+        next = p->sleep_next;
+        if (p->sleep_chan != chan)
+            continue;
+        waitq_remove(wq, p);
+        // p may still be switching out in sched(), wait for it.
         acquire(&p->lock);
-        if (p->state == SLEEPING && p->sleep_chan == chan) {
-            p->state = RUNNABLE;
-            add_task(p);
-        }
+        assert(p->state == SLEEPING);
+        p->state = RUNNABLE;
+        add_task(p);
         release(&p->lock);
+        n--;
+    }
+    release(&wq->lock);
+}
+
+// Wake up all processes sleeping on chan.
+void wakeup(void *chan) {
+    wakeup_n(chan, NPROC);
+}
+
+// Wake up the process sleeping longest on chan, avoid thundering herds when only one can proceed.
+void wakeup_one(void *chan) {
+    wakeup_n(chan, 1);
+}
+
+// Find the vma in mm covering exactly [start, end), it may be empty.
+static struct vma *find_vma_exact(struct mm *mm, uint64 start, uint64 end) {
+    for (struct vma *vma = mm->vma; vma; vma = vma->next) {
+        if (vma->vm_start == start && vma->vm_end == end)
+            return vma;
     }
+    return NULL;
+}
+
+// Add child to parent->children.
+// Caller should hold wait_lock.
+static void child_link(struct proc *parent, struct proc *child) {
+    child->parent       = parent;
+    child->sibling_prev = NULL;
+    child->sibling_next = parent->children;
+    if (parent->children)
+        parent->children->sibling_prev = child;
+    parent->children = child;
+}
+
+// Remove child from its parent->children.
+// Caller should hold wait_lock.
+static void child_unlink(struct proc *child) {
+    if (child->sibling_prev)
+        child->sibling_prev->sibling_next = child->sibling_next;
+    else
+        child->parent->children = child->sibling_next;
+    if (child->sibling_next)
+        child->sibling_next->sibling_prev = child->sibling_prev;
+    child->sibling_next = child->sibling_prev = NULL;
+    child->parent                             = NULL;
 }
 
 int fork() {
@@ -185,20 +373,117 @@ int fork() {
     if (mm_copy(p->mm, np->mm))
         panic("mm_copy");
 
+    np->vma_brk     = find_vma_exact(np->mm, p->vma_brk->vm_start, p->vma_brk->vm_end);
+    np->vma_ustack  = find_vma_exact(np->mm, p->vma_ustack->vm_start, p->vma_ustack->vm_end);
+    np->program_brk = p->program_brk;
+    sched_proc_init(np, p);
+
     // copy saved user registers.
     *(np->trapframe) = *(p->trapframe);
 
     // Cause fork to return 0 in the child.
     np->trapframe->a0 = 0;
-    np->parent        = p;
-    np->state         = RUNNABLE;
+    int pid           = np->pid;
+    release(&np->lock);
+    release(&p->lock);
+
+    acquire(&wait_lock);
+    child_link(p, np);
+    release(&wait_lock);
+
+    acquire(&np->lock);
+    np->state = RUNNABLE;
     add_task(np);
     release(&np->lock);
+
+    return pid;
+}
+
+// Start the app name in a new child process.
+// Unlike fork() + exec(), the parent's memory is never copied.
+int spawn(char *name) {
+    struct user_app *app = get_elf(name);
+    if (app == NULL)
+        return -1;
+
+    struct proc *np = allocproc();
+    if (np == NULL)
+        return -1;
+    if (load_user_elf(app, np) < 0) {
+        freeproc(np);
+        release(&np->lock);
+        return -1;
+    }
+
+    struct proc *p = curr_proc();
+    acquire(&p->lock);
+    sched_proc_init(np, p);
     release(&p->lock);
+    int pid = np->pid;
+    release(&np->lock);
+
+    acquire(&wait_lock);
+    child_link(p, np);
+    release(&wait_lock);
 
-    return np->pid;
+    acquire(&np->lock);
+    add_task(np);
+    release(&np->lock);
+
+    return pid;
 }
 
+#ifdef PROC_BENCH
+static void kthread_ret(void) {
+    struct proc *p = curr_proc();
+    release(&p->lock);
+    intr_on();
+    // see kthread_create()
+    ((void (*)(uint64))p->trapframe->a1)(p->trapframe->a0);
+    exit(0);
+}
+
+// Start fn(arg) in a new kernel thread, a child of the current process if there is one.
+// Kernel threads are never preempted and never return to user mode, only benchmarks run them.
+// Return its pid, or -1.
+int kthread_create(void (*fn)(uint64), uint64 arg) {
+    struct proc *np = allocproc();
+    if (np == NULL)
+        return -1;
+    // no user registers to keep, the trapframe holds fn and arg.
+    np->trapframe->a0 = arg;
+    np->trapframe->a1 = (uint64)fn;
+    np->context.ra    = (uint64)kthread_ret;
+
+    struct proc *p = curr_proc();
+    if (p != NULL) {
+        acquire(&p->lock);
+        sched_proc_init(np, p);
+        release(&p->lock);
+    }
+    int pid = np->pid;
+    release(&np->lock);
+
+    if (p != NULL) {
+        acquire(&wait_lock);
+        child_link(p, np);
+        release(&wait_lock);
+    }
+
+    acquire(&np->lock);
+    np->state = RUNNABLE;
+    add_task(np);
+    release(&np->lock);
+    return pid;
+}
+
+// Free p from allocproc() which never ran, and release p->lock.
+void proc_discard(struct proc *p) {
+    freeproc(p);
+    release(&p->lock);
+}
+#endif
+
 int exec(char *name) {
     struct user_app *app = get_elf(name);
     if (app == NULL)
@@ -212,7 +497,11 @@ int exec(char *name) {
     //  but keep trapframe and trampoline, because it belongs to curr_proc().
     mm_free_pages(p->mm);
 
-    load_user_elf(app, p);
+    if (load_user_elf(app, p) < 0) {
+        // the old image is gone, there is nothing to return to.
+        release(&p->lock);
+        exit(-1);
+    }
 
     release(&p->lock);
     return 0;
@@ -220,38 +509,34 @@ int exec(char *name) {
 
 int wait(int pid, int *code) {
     struct proc *child;
-    int havekids;
     struct proc *p = curr_proc();
 
     acquire(&wait_lock);
 
     for (;;) {
-        // Scan through table looking for exited children.
-        havekids = 0;
-        for (int i = 0; i < NPROC; i++) {
-            child = pool[i];
-            if (child == p)
-                continue;
-
-            acquire(&child->lock);
-            if (child->parent == p) {
-                havekids = 1;
-                if (child->state == ZOMBIE && (pid <= 0 || child->pid == pid)) {
-                    int cpid = child->pid;
-                    // Found one.
-                    if (code)
-                        *code = child->exit_code;
-                    freeproc(child);
-                    release(&child->lock);
-                    release(&wait_lock);
-                    return cpid;
-                }
+        // Look through our exited children.
+        for (struct proc **pz = &p->zombies; *pz; pz = &(*pz)->zombie_next) {
+            child = *pz;
+            if (pid <= 0 || child->pid == pid) {
+                // Found one.
+                *pz = child->zombie_next;
+                child_unlink(child);
+
+                // child may still be switching out in sched(), wait for it.
+                acquire(&child->lock);
+                assert(child->state == ZOMBIE);
+                int cpid = child->pid;
+                if (code)
+                    *code = child->exit_code;
+                freeproc(child);
+                release(&child->lock);
+                release(&wait_lock);
+                return cpid;
             }
-            release(&child->lock);
         }
 
         // No waiting if we don't have any children.
-        if (!havekids || p->killed) {
+        if (p->children == NULL || p->killed) {
             release(&wait_lock);
             return -1;
         }
@@ -265,26 +550,36 @@ int wait(int pid, int *code) {
 // Exit the current process.
 void exit(int code) {
     struct proc *p = curr_proc();
+    struct proc *c, *next;
 
     acquire(&wait_lock);
 
+    // reparent our children to init_proc, the exited ones are handed over too.
+    for (c = p->children; c; c = next) {
+        next = c->sibling_next;
+        child_link(init_proc, c);
+    }
+    p->children = NULL;
+    if (p->zombies) {
+        for (c = p->zombies; c; c = next) {
+            next               = c->zombie_next;
+            c->zombie_next     = init_proc->zombies;
+            init_proc->zombies = c;
+        }
+        p->zombies = NULL;
+        wakeup_one(init_proc);
+    }
+
     // wakeup wait-ing parent.
     //  There is no race because locking against "wait_lock"
-    wakeup(p->parent);
+    if (p->parent) {
+        p->zombie_next     = p->parent->zombies;
+        p->parent->zombies = p;
+        wakeup_one(p->parent);
+    }
 
     acquire(&p->lock);
 
-    // reparent
-    for (int i = 0; i < NPROC; i++) {
-        struct proc *np = pool[i];
-        if (np == p)
-            continue;
-        acquire(&np->lock);
-        if (np->parent == p)
-            np->parent = init_proc;
-        release(&np->lock);
-    }
-
     p->exit_code = code;
     p->state     = ZOMBIE;
 
@@ -297,7 +592,20 @@ void exit(int code) {
 // Grow or shrink user memory by n bytes.
 // Return 0 on succness, -1 on failure.
 int growproc(int n) {
-    uint64 program_brk;
-    panic("qwq");
+    struct proc *p   = curr_proc();
+    struct mm *mm    = p->mm;
+    uint64 old_brk   = p->program_brk;
+    uint64 new_brk   = old_brk + n;
+
+    if (n < 0 ? (new_brk > old_brk || new_brk < p->vma_brk->vm_start) : new_brk < old_brk)
+        return -1;
+
+    acquire(&mm->lock);
+    int ret = mm_resize_vma(p->vma_brk, PGROUNDUP(new_brk));
+    release(&mm->lock);
+    if (ret)
+        return -1;
+
+    p->program_brk = new_brk;
     return 0;
 }
@@ -3,6 +3,7 @@
 
 #include "queue.h"
 #include "riscv.h"
+#include "timer.h"
 #include "vm.h"
 
 enum {
@@ -40,10 +41,28 @@ struct cpu {
     int interrupt_on;              // Is the interrupt Enabled before the first push-off?
     uint64 sched_kstack_top;  // top of per-cpu sheduler kernel stack
     int cpuid;  // for debug purpose
+
+    // per-cpu scheduling state, see sched.c
+    int sched_online;         // whether this cpu has entered scheduler()
+    struct queue run_queue;   // RUNNABLE processes queued on this cpu
+    uint64 nr_switches;       // context switches performed by this cpu
+    uint64 nr_steals;         // processes stolen from other cpus' run_queue
+
+    uint64 asid_generation;   // ASID generation this cpu's TLB has been flushed for, see vm.c
+
+    int tick_mode;            // TICK_*, how the timer of this cpu is programmed, see sched.c
+    uint64 nr_ticks;          // timer interrupts taken by this cpu
+
+    uint64 ipi_pending;       // IPI_* reasons sent to this cpu, see smp.c
+    uint64 nr_ipis;           // software interrupts taken by this cpu
+
+    struct mm *uaccess_mm;    // mm accessed by copy_*_user, its page faults are handled by kernel_trap
 };
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+struct sched_class;
+
 // Per-process state
 struct proc {
     spinlock_t lock;
@@ -52,16 +71,34 @@ struct proc {
     int pid;               // Process ID
     uint64 exit_code;
     void *sleep_chan;
+    struct proc *sleep_next, *sleep_prev;  // wait queue of sleep_chan, see sleep()
+    struct timer sleep_timer;              // timeout of sleep_timeout()
+    int sleep_timed_out;
     int killed;
 
-    struct proc *parent;  // Parent process
+    int last_cpu;         // cpuid this process last ran on, -1 if never scheduled
+    const struct sched_class *sched_class;  // see sched.c
+    int priority;                           // share of cpu time is proportional to priority, see sched.c
+    uint64 stride, pass;                    // pass += stride for every timeslice, in all classes
+
+    // wait_lock must be held when accessing to these fields:
+    struct proc *parent;                       // Parent process
+    struct proc *children;                     // all children, including the zombies
+    struct proc *sibling_next, *sibling_prev;  // in parent->children
+    struct proc *zombies;                      // exited children, not reaped by wait() yet
+    struct proc *zombie_next;                  // in parent->zombies
 
     int index;
     struct mm *mm;
     struct vma *vma_ustack;
-    struct vma *vma_brk;
+    struct vma *vma_brk;                // heap, [vm_start, PGROUNDUP(program_brk))
+    uint64 program_brk;                 // current program break, moved by sbrk
     struct vma *vma_trapframe;
     struct vma *vma_trampoline;
+    struct vma *vma_vdso_text;
+    struct vma *vma_vdso_data;
+    struct vma *vma_uring;              // NULL until io_uring_setup()
+    struct uring *__kva uring;
     struct trapframe *__kva trapframe;  // data page for trampoline.S
     uint64 __kva kstack;                // Virtual address of kernel stack
     struct context context;             // swtch() here to run process
@@ -75,6 +112,13 @@ static inline int cpuid() {
 struct cpu *mycpu();
 struct cpu *getcpu(int i);
 
+// smp.c
+#define IPI_RESCHEDULE (1 << 0)  // work was queued on the cpu
+
+void ipi_init();
+void ipi_send(struct cpu *c, uint64 reason);
+uint64 ipi_handle();
+
 static inline struct proc *curr_proc() {
     return mycpu()->proc;
 }
@@ -84,18 +128,33 @@ void proc_init();
 struct proc *allocproc();
 int fork();
 int exec(char *);
+int spawn(char *);
 int wait(int, int *);
 void exit(int);
 int growproc(int n);
+#ifdef PROC_BENCH
+int kthread_create(void (*fn)(uint64), uint64 arg);
+void proc_discard(struct proc *p);
+#endif
 
 void sleep(void *chan, spinlock_t *lk);
+int sleep_timeout(void *chan, spinlock_t *lk, uint64 ticks);
+void sleep_ticks(uint64 ticks);
 void wakeup(void *chan);
+void wakeup_one(void *chan);
 
 // sched.c
+#define DEFAULT_PRIORITY (16)  // priority of the rr class
+
 void scheduler() __attribute__((noreturn));
 void sched();
 void yield();
 void add_task(struct proc *);
+int sched_tick();
+int sched_ipi();
+void sched_proc_init(struct proc *p, struct proc *parent);
+int sched_set_priority(struct proc *p, int prio);
+void sched_print_stats();
 
 // swtch.S
 void swtch(struct context *, struct context *);
@@ -8,6 +8,7 @@ void init_queue(struct queue *q) {
     spinlock_init(&q->lock, "queue");
     q->front = q->tail = 0;
     q->empty           = 1;
+    q->size            = 0;
 }
 
 void push_queue(struct queue *q, void *data) {
@@ -18,6 +19,7 @@ void push_queue(struct queue *q, void *data) {
     q->empty         = 0;
     q->data[q->tail] = data;
     q->tail          = (q->tail + 1) % NPROC;
+    q->size++;
     release(&q->lock);
 }
 
@@ -30,8 +32,23 @@ void *pop_queue(struct queue *q) {
 
     void *data = q->data[q->front];
     q->front   = (q->front + 1) % NPROC;
+    q->size--;
     if (q->front == q->tail)
         q->empty = 1;
     release(&q->lock);
     return data;
 }
+
+// Return the front element without removing it, NULL if empty.
+void *peek_queue(struct queue *q) {
+    acquire(&q->lock);
+    void *data = q->empty ? NULL : q->data[q->front];
+    release(&q->lock);
+    return data;
+}
+
+// Lockless read of the queue length.
+// The result is only a hint, the queue may change right after we read it.
+int queue_size(struct queue *q) {
+    return *(volatile int *)&q->size;
+}
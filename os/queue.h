@@ -11,10 +11,13 @@ struct queue {
     int front;
     int tail;
     int empty;
+    int size;  // number of queued elements, may be read locklessly as a hint
 };
 
 void init_queue(struct queue *);
 void push_queue(struct queue *, void *);
 void *pop_queue(struct queue *);
+void *peek_queue(struct queue *);
+int queue_size(struct queue *);
 
 #endif  // QUEUE_H
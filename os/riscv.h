@@ -29,6 +29,8 @@ static inline uint64 r_sip() {
     return x;
 }
 
+#define SIP_SSIP (1L << 1)  // software interrupt pending
+
 static inline void w_sip(uint64 x) {
     asm volatile("csrw sip, %0" : : "r"(x));
 }
@@ -76,6 +78,9 @@ static inline uint64 r_stvec() {
 #define SATP_SV39 (8L << 60)
 
 #define MAKE_SATP(pagetable)  (SATP_SV39 | (((uint64)pagetable) >> 12))
+#define SATP_ASID_SHIFT       44
+#define SATP_ASID_MASK        (0xFFFFULL << SATP_ASID_SHIFT)
+#define MAKE_SATP_ASID(pagetable, asid) (MAKE_SATP(pagetable) | (((uint64)(asid)) << SATP_ASID_SHIFT))
 #define SATP_TO_PGTABLE(satp) ((pagetable_t)(((satp) & ((1ULL << 44) - 1)) << PGSHIFT))
 
 // supervisor address translation and protection;
@@ -113,6 +118,19 @@ static inline uint64 r_stval() {
     return x;
 }
 
+// Supervisor Counter Enable, which counters user mode can read
+#define SCOUNTEREN_TM (1L << 1)  // rdtime
+static inline void w_scounteren(uint64 x) {
+    asm volatile("csrw scounteren, %0" : : "r"(x));
+}
+
+// cpu cycle counter
+static inline uint64 r_cycle() {
+    uint64 x;
+    asm volatile("csrr %0, cycle" : "=r"(x));
+    return x;
+}
+
 // machine-mode cycle counter
 static inline uint64 r_time() {
     uint64 x;
@@ -177,12 +195,28 @@ static inline void sfence_vma() {
     asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries of one address space, global mappings are kept.
+static inline void sfence_vma_asid(uint64 asid) {
+    asm volatile("sfence.vma zero, %0" : : "r"(asid) : "memory");
+}
+
+// flush the TLB entries of va in all address spaces.
+static inline void sfence_vma_addr(uint64 va) {
+    asm volatile("sfence.vma %0, zero" : : "r"(va) : "memory");
+}
+
+// flush the TLB entries of va in one address space.
+static inline void sfence_vma_addr_asid(uint64 va, uint64 asid) {
+    asm volatile("sfence.vma %0, %1" : : "r"(va), "r"(asid) : "memory");
+}
+
 #define PGSIZE    4096      // bytes per page
 #define PGSIZE_2M 0x200000  // bytes per page
 #define PGSHIFT   12        // bits of offset within a page
 
-#define ROUNDUP_2N(sz, base) (((sz) + (base) - 1) & ~((base) - 1))
-#define IS_ALIGNED(a, base)  (((a) & ((base) - 1)) == 0)
+#define ROUNDUP_2N(sz, base)   (((sz) + (base) - 1) & ~((base) - 1))
+#define ROUNDDOWN_2N(sz, base) ((sz) & ~((base) - 1))
+#define IS_ALIGNED(a, base)    (((a) & ((base) - 1)) == 0)
 
 #define PGROUNDUP(sz)  (((sz) + PGSIZE - 1) & ~(PGSIZE - 1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE - 1))
@@ -197,6 +231,10 @@ static inline void sfence_vma() {
 #define PTE_A (1L << 6)
 #define PTE_D (1L << 7)
 
+// bits reserved for supervisor software (RSW)
+#define PTE_COW  (1L << 8)  // copy-on-write: a writable page shared read-only after fork
+#define PTE_HUGE (1L << 9)  // level-1 leaf of a user 2 MiB page
+
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
 
@@ -13,6 +13,8 @@ const uint64 SBI_REMOTE_SFENCE_VMA_ASID = 7;
 const uint64 SBI_SHUTDOWN = 8;
 
 const uint64 SBI_HSM = 0x48534D;
+const uint64 SBI_IPI = 0x735049;
+const uint64 SBI_RFENCE = 0x52464E43;
 
 int inline sbi_call_legacy(uint64 which, uint64 arg0, uint64 arg1, uint64 arg2)
 {
@@ -24,14 +26,19 @@ int inline sbi_call_legacy(uint64 which, uint64 arg0, uint64 arg1, uint64 arg2)
 	return a0;
 }
 
-struct sbiret inline sbi_call(int32 eid, int32 fid, uint64 arg0, uint64 arg1, uint64 arg2)
+struct sbiret inline sbi_call(int32 eid, int32 fid, uint64 arg0, uint64 arg1, uint64 arg2, uint64 arg3, uint64 arg4)
 {
 	register uint64 a0 asm("a0") = arg0;
 	register uint64 a1 asm("a1") = arg1;
 	register uint64 a2 asm("a2") = arg2;
+	register uint64 a3 asm("a3") = arg3;
+	register uint64 a4 asm("a4") = arg4;
 	register uint64 a6 asm("a6") = fid;
 	register uint64 a7 asm("a7") = eid;
-	asm volatile("ecall" : "=r"(a0), "=r"(a1) : "r"(a0), "r"(a1), "r"(a2), "r"(a6), "r"(a7) : "memory");
+	asm volatile("ecall"
+		     : "=r"(a0), "=r"(a1)
+		     : "r"(a0), "r"(a1), "r"(a2), "r"(a3), "r"(a4), "r"(a6), "r"(a7)
+		     : "memory");
 	struct sbiret ret;
 	ret.error = a0;
 	ret.value = a1;
@@ -44,7 +51,31 @@ void sbi_putchar(int c)
 
 int sbi_hsm_hart_start(unsigned long hartid, unsigned long start_addr, unsigned long a1)
 {
-	struct sbiret ret = sbi_call(SBI_HSM, 0x0, hartid, start_addr, a1);
+	struct sbiret ret = sbi_call(SBI_HSM, 0x0, hartid, start_addr, a1, 0, 0);
+	return ret.error;
+}
+
+// Raise a supervisor software interrupt on the harts in hart_mask, offset by hart_mask_base.
+int sbi_send_ipi(unsigned long hart_mask, unsigned long hart_mask_base)
+{
+	struct sbiret ret = sbi_call(SBI_IPI, 0x0, hart_mask, hart_mask_base, 0, 0, 0);
+	return ret.error;
+}
+
+// Execute sfence.vma for [start, start + size) on the harts in hart_mask.
+// size of -1 flushes the whole address space.
+int sbi_remote_sfence_vma(unsigned long hart_mask, unsigned long hart_mask_base, unsigned long start,
+			  unsigned long size)
+{
+	struct sbiret ret = sbi_call(SBI_RFENCE, 0x1, hart_mask, hart_mask_base, start, size, 0);
+	return ret.error;
+}
+
+// Same as sbi_remote_sfence_vma, but only for the entries of asid.
+int sbi_remote_sfence_vma_asid(unsigned long hart_mask, unsigned long hart_mask_base, unsigned long start,
+			       unsigned long size, unsigned long asid)
+{
+	struct sbiret ret = sbi_call(SBI_RFENCE, 0x2, hart_mask, hart_mask_base, start, size, asid);
 	return ret.error;
 }
 
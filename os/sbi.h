@@ -12,5 +12,10 @@ void sbi_putchar(int);
 void shutdown();
 void set_timer(uint64 stime);
 int sbi_hsm_hart_start(unsigned long hartid, unsigned long start_addr, unsigned long a1);
+int sbi_send_ipi(unsigned long hart_mask, unsigned long hart_mask_base);
+int sbi_remote_sfence_vma(unsigned long hart_mask, unsigned long hart_mask_base, unsigned long start,
+			  unsigned long size);
+int sbi_remote_sfence_vma_asid(unsigned long hart_mask, unsigned long hart_mask_base, unsigned long start,
+			       unsigned long size, unsigned long asid);
 
 #endif // SBI_H
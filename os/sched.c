@@ -4,26 +4,394 @@
 #include "proc.h"
 #include "queue.h"
 #include "trap.h"
+#include "timer.h"
 
-static struct queue task_queue;
+// Each cpu owns a run_queue of RUNNABLE processes (see struct cpu).
+//  - add_task() places a process on the cpu it last ran on, unless that
+//    run_queue is notably longer than the shortest one.
+//  - fetch_task() pops from the local run_queue first, and an idle cpu
+//    steals from the busiest run_queue of the other cpus.
+// Every run_queue has its own lock, so harts only contend when stealing.
+//
+// The queues are owned by scheduling classes. Each process belongs to one class (p->sched_class).
+//  - rr_class: round-robin on c->run_queue, the default.
+//  - stride_class: stride scheduling, entered by sys_set_priority().
+// All classes share one pass space per cpu: every process is charged its stride per timeslice,
+//  rr processes at DEFAULT_PRIORITY, and fetch_task() runs the lowest pass of all classes.
+//  So cpu time is shared in proportion to priority among all processes of a cpu.
+
+// Ticks are dynamic, see sched_tick():
+//  - TICK_PERIODIC: one timer interrupt per timeslice, when processes are waiting in the local queues.
+//  - TICK_STRETCHED: the running process is alone on its cpu, keep it running for TICKS_STRETCHED.
+//  - TICK_IDLE: nothing to run, the timer is stopped.
+//    add_task() kicks an idle (or stretched) cpu with an IPI when it queues work on it.
+//  Stretched and idle timeslices end early for the next timer of the wheel (see timer.c).
+
+// Max allowed difference in run_queue length before add_task() migrates a process.
+#define SCHED_IMBALANCE (2)
+
+#define TICK_PERIODIC  (0)
+#define TICK_STRETCHED (1)
+#define TICK_IDLE      (2)
+
+#define TICKS_STRETCHED (10)
 
 // defined in proc.c
 extern struct proc *pool[NPROC];
 
+struct sched_class {
+    const char *name;
+    void (*init)();
+    void (*enqueue)(struct cpu *c, struct proc *p);  // p->lock is held
+    struct proc *(*dequeue)(struct cpu *c);          // pop the next process to run, or NULL
+    uint64 (*next_pass)(struct cpu *c);              // pass of the process dequeue() would pop, -1 if none
+    int (*nr_queued)(struct cpu *c);                 // may be read locklessly as a hint
+};
+
+#define BIG_STRIDE (1ULL << 20)
+
+// Virtual time of each cpu: the pass of the last process dequeued there.
+// Dequeues of different classes (or a stealer) may race, losing an update only delays vtime,
+//  which is a floor for the pass of enqueued processes.
+static uint64 vtime[NCPU];
+
+static void advance_vtime(struct cpu *c, uint64 pass) {
+    if (pass > vtime[c->cpuid])
+        *(volatile uint64 *)&vtime[c->cpuid] = pass;
+}
+
+// a process coming back from sleep, or from another cpu, should not catch up for the lost time.
+static void catch_up_vtime(struct cpu *c, struct proc *p) {
+    p->pass = MAX(p->pass, *(volatile uint64 *)&vtime[c->cpuid]);
+}
+
+// charge p the timeslice it is going to run on c.
+static void charge_timeslice(struct cpu *c, struct proc *p) {
+    advance_vtime(c, p->pass);
+    p->pass += p->stride;
+}
+
+// round-robin class
+
+static void rr_init() {
+    for (int i = 0; i < NCPU; i++) {
+        init_queue(&getcpu(i)->run_queue);
+    }
+}
+
+static void rr_enqueue(struct cpu *c, struct proc *p) {
+    catch_up_vtime(c, p);
+    push_queue(&c->run_queue, p);
+}
+
+static struct proc *rr_dequeue(struct cpu *c) {
+    struct proc *p = pop_queue(&c->run_queue);
+    if (p != NULL)
+        charge_timeslice(c, p);
+    return p;
+}
+
+// The FIFO head is not always the lowest pass of the queue: a process woken with the current vtime
+//  queues behind processes charged beyond it. All rr processes have the same stride, so the error is
+//  at most one round of the queue, and the shares are approximate, see sched_share_bench().
+static uint64 rr_next_pass(struct cpu *c) {
+    struct proc *p = peek_queue(&c->run_queue);
+    return p == NULL ? -1ULL : p->pass;
+}
+
+static int rr_nr_queued(struct cpu *c) {
+    return queue_size(&c->run_queue);
+}
+
+static const struct sched_class rr_class = {
+    .name      = "rr",
+    .init      = rr_init,
+    .enqueue   = rr_enqueue,
+    .dequeue   = rr_dequeue,
+    .next_pass = rr_next_pass,
+    .nr_queued = rr_nr_queued,
+};
+
+// stride class
+
+// a min-heap of processes ordered by pass.
+struct stride_rq {
+    spinlock_t lock;
+    struct proc *heap[NPROC];
+    int size;
+};
+static struct stride_rq stride_rqs[NCPU];
+
+static void stride_init() {
+    for (int i = 0; i < NCPU; i++) {
+        spinlock_init(&stride_rqs[i].lock, "stride_rq");
+    }
+}
+
+static void stride_enqueue(struct cpu *c, struct proc *p) {
+    struct stride_rq *rq = &stride_rqs[c->cpuid];
+    acquire(&rq->lock);
+    assert(rq->size < NPROC);
+    catch_up_vtime(c, p);
+    int i = rq->size++;
+    while (i > 0 && rq->heap[(i - 1) / 2]->pass > p->pass) {
+        rq->heap[i] = rq->heap[(i - 1) / 2];
+        i           = (i - 1) / 2;
+    }
+    rq->heap[i] = p;
+    release(&rq->lock);
+}
+
+static struct proc *stride_dequeue(struct cpu *c) {
+    struct stride_rq *rq = &stride_rqs[c->cpuid];
+    acquire(&rq->lock);
+    if (rq->size == 0) {
+        release(&rq->lock);
+        return NULL;
+    }
+    struct proc *p    = rq->heap[0];
+    struct proc *last = rq->heap[--rq->size];
+    int i             = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= rq->size)
+            break;
+        if (child + 1 < rq->size && rq->heap[child + 1]->pass < rq->heap[child]->pass)
+            child++;
+        if (last->pass <= rq->heap[child]->pass)
+            break;
+        rq->heap[i] = rq->heap[child];
+        i           = child;
+    }
+    rq->heap[i] = last;
+
+    charge_timeslice(c, p);
+    release(&rq->lock);
+    return p;
+}
+
+static uint64 stride_next_pass(struct cpu *c) {
+    struct stride_rq *rq = &stride_rqs[c->cpuid];
+    acquire(&rq->lock);
+    uint64 pass = rq->size == 0 ? -1ULL : rq->heap[0]->pass;
+    release(&rq->lock);
+    return pass;
+}
+
+static int stride_nr_queued(struct cpu *c) {
+    return *(volatile int *)&stride_rqs[c->cpuid].size;
+}
+
+static const struct sched_class stride_class = {
+    .name      = "stride",
+    .init      = stride_init,
+    .enqueue   = stride_enqueue,
+    .dequeue   = stride_dequeue,
+    .next_pass = stride_next_pass,
+    .nr_queued = stride_nr_queued,
+};
+
+static const struct sched_class *sched_classes[] = {&rr_class, &stride_class};
+#define NR_SCHED_CLASSES (sizeof(sched_classes) / sizeof(sched_classes[0]))
+
 void sched_init() {
-    init_queue(&task_queue);
+    for (int i = 0; i < NR_SCHED_CLASSES; i++) {
+        sched_classes[i]->init();
+    }
+}
+
+// Set up the scheduling state of a new process, inherited from parent if not NULL.
+void sched_proc_init(struct proc *p, struct proc *parent) {
+    p->sched_class = parent ? parent->sched_class : &rr_class;
+    p->priority    = parent ? parent->priority : DEFAULT_PRIORITY;
+    p->stride      = BIG_STRIDE / p->priority;
+    p->pass        = 0;
+}
+
+// Move p into the stride class with priority prio, DEFAULT_PRIORITY is the share of an rr process.
+// p->lock must be held, and p must not be queued.
+// Return prio.
+int sched_set_priority(struct proc *p, int prio) {
+    assert(holding(&p->lock));
+    assert(prio >= 2);
+    p->sched_class = &stride_class;
+    p->priority    = prio;
+    p->stride      = BIG_STRIDE / prio;
+    return prio;
+}
+
+// Number of processes queued on c in all classes.
+static int nr_queued(struct cpu *c) {
+    int n = 0;
+    for (int i = 0; i < NR_SCHED_CLASSES; i++) {
+        n += sched_classes[i]->nr_queued(c);
+    }
+    return n;
+}
+
+// Pop the process with the lowest pass among the classes of c.
+static struct proc *dequeue_task(struct cpu *c) {
+    const struct sched_class *next = NULL;
+    uint64 next_pass               = -1ULL;
+    for (int i = 0; i < NR_SCHED_CLASSES; i++) {
+        uint64 pass = sched_classes[i]->next_pass(c);
+        if (pass != -1ULL && (next == NULL || pass < next_pass)) {
+            next      = sched_classes[i];
+            next_pass = pass;
+        }
+    }
+    if (next != NULL) {
+        struct proc *p = next->dequeue(c);
+        if (p != NULL)
+            return p;
+    }
+    // a stealer drained that class meanwhile, take whatever is left.
+    for (int i = 0; i < NR_SCHED_CLASSES; i++) {
+        struct proc *p = sched_classes[i]->dequeue(c);
+        if (p != NULL)
+            return p;
+    }
+    return NULL;
+}
+
+// Choose the cpu whose run_queue will hold p.
+static struct cpu *select_task_cpu(struct proc *p) {
+    struct cpu *target = mycpu();
+    if (p->last_cpu >= 0 && getcpu(p->last_cpu)->sched_online)
+        target = getcpu(p->last_cpu);
+
+    struct cpu *idlest = NULL;
+    for (int i = 0; i < NCPU; i++) {
+        struct cpu *c = getcpu(i);
+        if (!c->sched_online)
+            continue;
+        if (idlest == NULL || nr_queued(c) < nr_queued(idlest))
+            idlest = c;
+    }
+
+    // No cpu is scheduling yet (e.g. loading the init proc): use the current cpu.
+    if (idlest == NULL)
+        return target;
+
+    // A process which never ran has no cache affinity, spread it out.
+    if (p->last_cpu < 0)
+        return idlest;
+
+    if (!target->sched_online || nr_queued(target) - nr_queued(idlest) > SCHED_IMBALANCE)
+        return idlest;
+    return target;
+}
+
+static void set_tick_mode(struct cpu *c, int mode) {
+    c->tick_mode = mode;
+    switch (mode) {
+        case TICK_PERIODIC:
+            set_next_timer();
+            break;
+        case TICK_STRETCHED:
+            set_timer_ticks(MIN(TICKS_STRETCHED, timer_next_event()));
+            break;
+        case TICK_IDLE: {
+            uint64 next = timer_next_event();
+            if (next == -1ULL)
+                stop_timer();
+            else
+                set_timer_ticks(next);
+            break;
+        }
+    }
+}
+
+// Called on every timer interrupt of this cpu, re-arm the timer.
+// Return whether the running process should yield.
+int sched_tick() {
+    struct cpu *c = mycpu();
+    c->nr_ticks++;
+    timer_run();
+    if (c->proc == NULL) {
+        // in scheduler(), it decides the tick mode itself.
+        set_tick_mode(c, c->tick_mode);
+        return 0;
+    }
+    if (nr_queued(c) == 0) {
+        // no one else to run here, save the interrupts.
+        set_tick_mode(c, TICK_STRETCHED);
+        return 0;
+    }
+    set_tick_mode(c, TICK_PERIODIC);
+    return 1;
+}
+
+// Called on an IPI_RESCHEDULE of this cpu, work was queued here by another cpu.
+// Return whether the running process should yield.
+int sched_ipi() {
+    struct cpu *c = mycpu();
+    // in scheduler(), it looks at the queues after the interrupt.
+    if (c->proc == NULL || nr_queued(c) == 0)
+        return 0;
+    if (c->tick_mode == TICK_STRETCHED)
+        set_tick_mode(c, TICK_PERIODIC);
+    return 1;
+}
+
+// Steal one process from the busiest run_queue of other cpus.
+static struct proc *steal_task(struct cpu *c) {
+    struct cpu *busiest = NULL;
+    for (int i = 0; i < NCPU; i++) {
+        struct cpu *victim = getcpu(i);
+        if (victim == c || nr_queued(victim) == 0)
+            continue;
+        if (busiest == NULL || nr_queued(victim) > nr_queued(busiest))
+            busiest = victim;
+    }
+    if (busiest == NULL)
+        return NULL;
+
+    // the queues may be drained between nr_queued() and dequeue_task(), which handles it.
+    struct proc *proc = dequeue_task(busiest);
+    if (proc != NULL) {
+        c->nr_steals++;
+        debugf("steal task (pid=%d) from cpu %d", proc->pid, busiest->cpuid);
+    }
+    return proc;
 }
 
 static struct proc *fetch_task() {
-    struct proc *proc = pop_queue(&task_queue);
+    struct cpu *c     = mycpu();
+    struct proc *proc = dequeue_task(c);
+    if (proc == NULL)
+        proc = steal_task(c);
     if (proc != NULL)
         debugf("fetch task (pid=%d) from task queue", proc->pid);
     return proc;
 }
 
 void add_task(struct proc *p) {
-    push_queue(&task_queue, p);
-    debugf("add task (pid=%d) to task queue", p->pid);
+    struct cpu *c = select_task_cpu(p);
+    p->sched_class->enqueue(c, p);
+    if (c == mycpu()) {
+        // the running process is no longer alone.
+        if (c->proc != NULL && c->proc != p && c->tick_mode == TICK_STRETCHED)
+            set_tick_mode(c, TICK_PERIODIC);
+    } else {
+        // pairs with the fence in scheduler() before wfi: either c sees p in its queue,
+        //  or we see it idle and kick it.
+        MEMORY_FENCE();
+        int mode = *(volatile int *)&c->tick_mode;
+        if (mode == TICK_IDLE || mode == TICK_STRETCHED)
+            ipi_send(c, IPI_RESCHEDULE);
+    }
+    debugf("add task (pid=%d) to %s queue of cpu %d", p->pid, p->sched_class->name, c->cpuid);
+}
+
+// Print per-cpu scheduler counters, triggered by Ctrl-P on the console.
+void sched_print_stats() {
+    printf("\ncpu  online  queued  switches  steals  ticks  ipis\n");
+    for (int i = 0; i < NCPU; i++) {
+        struct cpu *c = getcpu(i);
+        printf("%d    %d       %d       %d  %d  %d  %d\n", i, c->sched_online, nr_queued(c), (int)c->nr_switches, (int)c->nr_steals,
+               (int)c->nr_ticks, (int)c->nr_ipis);
+    }
 }
 
 static int all_dead() {
@@ -56,6 +424,9 @@ void scheduler() {
     // If this scheduler finds any possible process to run, it will switch to it.
     // 	And the scheduler context is saved on "mycpu()->sched_context"
 
+    c->sched_online = 1;
+    MEMORY_FENCE();
+
     for (;;) {
         // intr may be on here.
 
@@ -67,6 +438,13 @@ void scheduler() {
                 panic("[cpu %d] scheduler dead.", c->cpuid);
             } else {
                 // nothing to run; stop running on this core until an interrupt.
+                if (c->tick_mode != TICK_IDLE) {
+                    set_tick_mode(c, TICK_IDLE);
+                    // add_task() may have missed that we are idle, look again.
+                    MEMORY_FENCE();
+                    if (nr_queued(c) > 0)
+                        continue;
+                }
                 intr_on();
                 asm volatile("wfi");
                 intr_off();
@@ -74,11 +452,18 @@ void scheduler() {
             }
         }
 
+        // leaving idle, or the stretched timeslice may be too long now:
+        //  others are waiting, or a timer was armed since.
+        if (c->tick_mode != TICK_PERIODIC)
+            set_tick_mode(c, nr_queued(c) > 0 ? TICK_PERIODIC : TICK_STRETCHED);
+
         acquire(&p->lock);
         assert(p->state == RUNNABLE);
         infof("switch to proc %d(%d)", p->index, p->pid);
-        p->state = RUNNING;
-        c->proc  = p;
+        p->state    = RUNNING;
+        p->last_cpu = c->cpuid;
+        c->proc     = p;
+        c->nr_switches++;
         swtch(&c->sched_context, &p->context);
 
         // When we get back here, someone must have called swtch(..., &c->sched_context);
@@ -86,6 +471,7 @@ void scheduler() {
         assert(!intr_get());        // scheduler should never have intr_on()
         assert(holding(&p->lock));  // whoever switch to us must acquire p->lock
         c->proc = NULL;
+        mm_deactivate(p->mm);
 
         if (p->state == RUNNABLE) {
             add_task(p);
@@ -1,6 +1,7 @@
 #include "defs.h"
 #include "log.h"
 #include "proc.h"
+#include "sbi.h"
 #include "string.h"
 
 static struct cpu cpus[NCPU];
@@ -14,4 +15,25 @@ struct cpu* mycpu() {
 struct cpu* getcpu(int i) {
     assert(i >= 0 && i < NCPU);
     return &cpus[i];
+}
+
+// Enable software interrupts, which carry IPIs, on this hart.
+void ipi_init() {
+    w_sie(r_sie() | SIE_SSIE);
+}
+
+// Interrupt cpu c for reason (IPI_*), reasons are accumulated until c handles them.
+void ipi_send(struct cpu* c, uint64 reason) {
+    __sync_fetch_and_or(&c->ipi_pending, reason);
+    sbi_send_ipi(1UL << c->mhart_id, 0);
+}
+
+// Acknowledge the software interrupt on this hart.
+// Return the IPI_* reasons sent since the last call.
+uint64 ipi_handle() {
+    struct cpu* c = mycpu();
+    // clear first: an IPI sent after the swap below raises the interrupt again.
+    w_sip(r_sip() & ~SIP_SSIP);
+    c->nr_ipis++;
+    return __sync_lock_test_and_set(&c->ipi_pending, 0);
 }
\ No newline at end of file
@@ -1,13 +1,43 @@
 #include "string.h"
+#include "riscv.h"
 #include "types.h"
 
+// The mem* functions below move aligned 64-bit words, unrolled by 8, with byte-wise
+//  head and tail. Misaligned word accesses are emulated by M-mode on VisionFive2, so
+//  memmove/memcmp fall back to bytes when src and dst are not equally aligned.
+#define WSIZE	   sizeof(uint64)
+#define WMASK	   (WSIZE - 1)
+#define UNROLL	   8
+#define ALIGNED(p) (((uint64)(p)&WMASK) == 0)
+
 void *memset(void *dst, int c, uint n)
 {
-	char *cdst = (char *)dst;
-	int i;
-	for (i = 0; i < n; i++) {
-		cdst[i] = c;
+	uchar *d = dst;
+	uint64 w = (uchar)c;
+	w |= w << 8;
+	w |= w << 16;
+	w |= w << 32;
+
+	while (n > 0 && !ALIGNED(d)) {
+		*d++ = c;
+		n--;
+	}
+	uint64 *wd = (uint64 *)d;
+	for (; n >= UNROLL * WSIZE; n -= UNROLL * WSIZE, wd += UNROLL) {
+		wd[0] = w;
+		wd[1] = w;
+		wd[2] = w;
+		wd[3] = w;
+		wd[4] = w;
+		wd[5] = w;
+		wd[6] = w;
+		wd[7] = w;
 	}
+	for (; n >= WSIZE; n -= WSIZE)
+		*wd++ = w;
+	d = (uchar *)wd;
+	while (n-- > 0)
+		*d++ = c;
 	return dst;
 }
 
@@ -17,6 +47,17 @@ int memcmp(const void *v1, const void *v2, uint n)
 
 	s1 = v1;
 	s2 = v2;
+	if (ALIGNED((uint64)s1 ^ (uint64)s2)) {
+		while (n > 0 && !ALIGNED(s1)) {
+			if (*s1 != *s2)
+				return *s1 - *s2;
+			s1++, s2++, n--;
+		}
+		// skip equal words, the differing one is found by the byte loop below.
+		while (n >= WSIZE && *(const uint64 *)s1 == *(const uint64 *)s2) {
+			s1 += WSIZE, s2 += WSIZE, n -= WSIZE;
+		}
+	}
 	while (n-- > 0) {
 		if (*s1 != *s2)
 			return *s1 - *s2;
@@ -26,13 +67,82 @@ int memcmp(const void *v1, const void *v2, uint n)
 	return 0;
 }
 
+// Copy n bytes forward, d and s are equally aligned.
+static void copy_forward(uchar *d, const uchar *s, uint n)
+{
+	while (n > 0 && !ALIGNED(d)) {
+		*d++ = *s++;
+		n--;
+	}
+	uint64 *wd = (uint64 *)d;
+	const uint64 *ws = (const uint64 *)s;
+	for (; n >= UNROLL * WSIZE; n -= UNROLL * WSIZE, wd += UNROLL, ws += UNROLL) {
+		uint64 t0 = ws[0], t1 = ws[1], t2 = ws[2], t3 = ws[3];
+		uint64 t4 = ws[4], t5 = ws[5], t6 = ws[6], t7 = ws[7];
+		wd[0] = t0;
+		wd[1] = t1;
+		wd[2] = t2;
+		wd[3] = t3;
+		wd[4] = t4;
+		wd[5] = t5;
+		wd[6] = t6;
+		wd[7] = t7;
+	}
+	for (; n >= WSIZE; n -= WSIZE)
+		*wd++ = *ws++;
+	d = (uchar *)wd;
+	s = (const uchar *)ws;
+	while (n-- > 0)
+		*d++ = *s++;
+}
+
+// Copy n bytes backward from d + n and s + n, d and s are equally aligned.
+static void copy_backward(uchar *d, const uchar *s, uint n)
+{
+	d += n;
+	s += n;
+	while (n > 0 && !ALIGNED(d)) {
+		*--d = *--s;
+		n--;
+	}
+	uint64 *wd = (uint64 *)d;
+	const uint64 *ws = (const uint64 *)s;
+	for (; n >= UNROLL * WSIZE; n -= UNROLL * WSIZE) {
+		wd -= UNROLL, ws -= UNROLL;
+		uint64 t0 = ws[0], t1 = ws[1], t2 = ws[2], t3 = ws[3];
+		uint64 t4 = ws[4], t5 = ws[5], t6 = ws[6], t7 = ws[7];
+		wd[0] = t0;
+		wd[1] = t1;
+		wd[2] = t2;
+		wd[3] = t3;
+		wd[4] = t4;
+		wd[5] = t5;
+		wd[6] = t6;
+		wd[7] = t7;
+	}
+	for (; n >= WSIZE; n -= WSIZE)
+		*--wd = *--ws;
+	d = (uchar *)wd;
+	s = (const uchar *)ws;
+	while (n-- > 0)
+		*--d = *--s;
+}
+
 void *memmove(void *dst, const void *src, uint n)
 {
-	const char *s;
-	char *d;
+	const uchar *s;
+	uchar *d;
 
 	s = src;
 	d = dst;
+	if (ALIGNED((uint64)s ^ (uint64)d)) {
+		if (s < d && s + n > d)
+			copy_backward(d, s, n);
+		else
+			copy_forward(d, s, n);
+		return dst;
+	}
+
 	if (s < d && s + n > d) {
 		s += n;
 		d += n;
@@ -45,6 +155,41 @@ void *memmove(void *dst, const void *src, uint n)
 	return dst;
 }
 
+// Zero a page-aligned page, no alignment checks or tails.
+void clear_page(void *page)
+{
+	uint64 *p = page;
+	for (int i = 0; i < PGSIZE / WSIZE; i += UNROLL) {
+		p[i + 0] = 0;
+		p[i + 1] = 0;
+		p[i + 2] = 0;
+		p[i + 3] = 0;
+		p[i + 4] = 0;
+		p[i + 5] = 0;
+		p[i + 6] = 0;
+		p[i + 7] = 0;
+	}
+}
+
+// Copy a page-aligned page, the pages must not overlap.
+void copy_page(void *dst, const void *src)
+{
+	uint64 *d = dst;
+	const uint64 *s = src;
+	for (int i = 0; i < PGSIZE / WSIZE; i += UNROLL) {
+		uint64 t0 = s[i + 0], t1 = s[i + 1], t2 = s[i + 2], t3 = s[i + 3];
+		uint64 t4 = s[i + 4], t5 = s[i + 5], t6 = s[i + 6], t7 = s[i + 7];
+		d[i + 0] = t0;
+		d[i + 1] = t1;
+		d[i + 2] = t2;
+		d[i + 3] = t3;
+		d[i + 4] = t4;
+		d[i + 5] = t5;
+		d[i + 6] = t6;
+		d[i + 7] = t7;
+	}
+}
+
 // memcpy exists to placate GCC.  Use memmove.
 void *memcpy(void *dst, const void *src, uint n)
 {
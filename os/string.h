@@ -10,5 +10,7 @@ char *safestrcpy(char *, const char *, int);
 int strlen(const char *);
 int strncmp(const char *, const char *, uint);
 char *strncpy(char *, const char *, int);
+void clear_page(void *);
+void copy_page(void *, const void *);
 
 #endif // STRING_H
\ No newline at end of file
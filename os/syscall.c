@@ -5,52 +5,62 @@
 #include "loader.h"
 #include "timer.h"
 #include "trap.h"
+#include "uring.h"
 
-uint64 sys_write(int fd, uint64 va, uint len) {
+// Handlers take every argument as the raw uint64 register and narrow it explicitly.
+// int arguments are sign-extended by user code, reject registers that are not.
+static inline int arg_is_int(uint64 a) {
+    return (int64)a == (int)a;
+}
+
+uint64 sys_write(uint64 fd, uint64 va, uint64 len) {
     debugf("sys_write fd = %d str = %p, len = %d", fd, va, len);
-    if (fd != STDOUT)
+    // lengths are 32-bit in write().
+    if (fd != STDOUT || len > 0xffffffffULL)
         return -1;
     return user_console_write(va, len);
 }
 
-uint64 sys_read(int fd, uint64 va, uint64 len) {
+uint64 sys_read(uint64 fd, uint64 va, uint64 len) {
     debugf("sys_read fd = %d str = %p, len = %d", fd, va, len);
-    if (fd != STDIN)
+    if (fd != STDIN || (int64)len < 0)
         return -1;
 
     return user_console_read(va, len);
 }
 
-__noreturn void sys_exit(int code) {
-    exit(code);
+uint64 sys_exit(uint64 code) {
+    // only the low 32 bits are the exit code.
+    exit((int)code);
     __builtin_unreachable();
 }
 
-uint64 sys_sched_yield() {
+uint64 sys_sched_yield(void) {
     yield();
     return 0;
 }
 
-uint64 sys_gettimeofday(uint64 val, int _tz) {
+uint64 sys_gettimeofday(uint64 val, uint64 _tz) {
     struct proc *p = curr_proc();
     uint64 cycle   = get_cycle();
     TimeVal t;
+    // keep in sync with vdso_gettimeofday
     t.sec  = cycle / CPU_FREQ;
     t.usec = (cycle % CPU_FREQ) * 1000000 / CPU_FREQ;
     copy_to_user(p->mm, val, (char *)&t, sizeof(TimeVal));
     return 0;
 }
 
-uint64 sys_getpid() {
+uint64 sys_getpid(void) {
     return curr_proc()->pid;
 }
 
-uint64 sys_getppid() {
+uint64 sys_getppid(void) {
     struct proc *p = curr_proc();
     return p->parent == NULL ? 0 : p->parent->pid;
 }
 
-uint64 sys_clone() {
+uint64 sys_clone(void) {
     debugf("fork!\n");
     return fork();
 }
@@ -63,85 +73,176 @@ uint64 sys_exec(uint64 va) {
     return exec(name);
 }
 
-uint64 sys_wait(int pid, uint64 va) {
+uint64 sys_wait(uint64 pid, uint64 va) {
     struct proc *p = curr_proc();
+    int code;
 
-    acquire(&p->lock);
-    acquire(&p->mm->lock);
-    uint64 pa = useraddr(p->mm, va);
-    release(&p->mm->lock);
-    release(&p->lock);
+    if (!arg_is_int(pid))
+        return -1;
+    // wait() reaps the child, probe va first so a bad pointer fails before the exit code is lost.
+    // copy_to_user breaks copy-on-write of the page holding the exit code.
+    code = 0;
+    if (va != 0 && copy_to_user(p->mm, va, (char *)&code, sizeof(code)) < 0)
+        return -1;
+    int ret = wait((int)pid, &code);
+    // the probe made the page writable, a failure now cannot be undone: the child is reaped,
+    //  so return its pid anyway, as Linux does.
+    if (ret >= 0 && va != 0)
+        copy_to_user(p->mm, va, (char *)&code, sizeof(code));
+    return ret;
+}
+
+uint64 sys_nanosleep(uint64 req, uint64 rem) {
+    struct proc *p = curr_proc();
+    TimeSpec ts;
+    int ret = copy_from_user(p->mm, (char *)&ts, req, sizeof(TimeSpec));
+    // sec is a signed time_t in user space.
+    if (ret < 0 || (int64)ts.sec < 0 || ts.nsec >= 1000000000)
+        return -1;
+
+    // longer sleeps are forever anyway, the clamp keeps deadlines in ticks from wrapping.
+    const uint64 max_sec = (1ULL << 62) / TICKS_PER_SEC;
+    // round up to ticks.
+    const uint64 nsec_per_tick = 1000000000 / TICKS_PER_SEC;
+    sleep_ticks(MIN(ts.sec, max_sec) * TICKS_PER_SEC + (ts.nsec + nsec_per_tick - 1) / nsec_per_tick);
 
-    int *code = (int *)PA_TO_KVA(pa);
-    return wait(pid, code);
+    if (rem) {
+        TimeSpec zero = {0, 0};
+        copy_to_user(p->mm, rem, (char *)&zero, sizeof(TimeSpec));
+    }
+    return 0;
 }
 
 uint64 sys_spawn(uint64 va) {
-    // TODO: your job is to complete the sys call
-    return -1;
+    struct proc *p = curr_proc();
+    char name[200];
+    copystr_from_user(p->mm, name, va, 200);
+    debugf("sys_spawn %s\n", name);
+    return spawn(name);
 }
 
-uint64 sys_set_priority(long long prio) {
-    // TODO: your job is to complete the sys call
-    return -1;
+uint64 sys_set_priority(uint64 prio) {
+    struct proc *p = curr_proc();
+    if ((int64)prio < 2 || (int64)prio > 0x7fffffff)
+        return -1;
+    acquire(&p->lock);
+    int ret = sched_set_priority(p, (int)prio);
+    release(&p->lock);
+    return ret;
 }
 
-uint64 sys_sbrk(int n) {
+uint64 sys_sbrk(uint64 n) {
     uint64 addr;
     struct proc *p = curr_proc();
-    panic("sbrk");
-    // addr = p->program_brk;
-    // if (growproc(n) < 0)
-    // return -1;
+    addr           = p->program_brk;
+    if (!arg_is_int(n) || growproc((int)n) < 0)
+        return -1;
     return addr;
 }
 
+uint64 sys_mmap(uint64 addr, uint64 len, uint64 prot, uint64 flags, uint64 fd, uint64 offset) {
+    if (!arg_is_int(prot) || !arg_is_int(flags))
+        return -1;
+    if (!(flags & MAP_ANONYMOUS) || (flags & MAP_SHARED) || !(prot & (PROT_READ | PROT_WRITE | PROT_EXEC)))
+        return -1;
+    uint64 pte_flags = PTE_U;
+    if (prot & PROT_READ)
+        pte_flags |= PTE_R;
+    if (prot & PROT_WRITE)
+        pte_flags |= PTE_R | PTE_W;  // W without R is reserved
+    if (prot & PROT_EXEC)
+        pte_flags |= PTE_X;
+
+    uint64 va = mm_mmap(curr_proc()->mm, addr, len, pte_flags, flags & MAP_FIXED);
+    if (va == 0)
+        return -1;
+    return va;
+}
+
+uint64 sys_munmap(uint64 addr, uint64 len) {
+    return mm_munmap(curr_proc()->mm, addr, len);
+}
+
+uint64 sys_io_uring_setup(void) {
+    uint64 va = uring_setup(curr_proc());
+    if (va == 0)
+        return -1;
+    return va;
+}
+
+uint64 sys_io_uring_enter(uint64 to_submit) {
+    if (to_submit > 0xffffffffULL)
+        return -1;
+    return uring_enter(curr_proc(), (uint)to_submit);
+}
+
+// nargs selects the handler type, so each handler is called through its own prototype.
+struct syscall_desc {
+    const char *name;
+    int nargs;
+    union {
+        uint64 (*fn0)(void);
+        uint64 (*fn1)(uint64);
+        uint64 (*fn2)(uint64, uint64);
+        uint64 (*fn3)(uint64, uint64, uint64);
+        uint64 (*fn6)(uint64, uint64, uint64, uint64, uint64, uint64);
+    };
+};
+
+#define SYSCALL(id, handler, n) [SYS_##id] = {.name = #id, .nargs = (n), .fn##n = (handler)}
+#define NR_SYSCALL              (SYS_io_uring_enter + 1)
+
+static const struct syscall_desc syscall_table[NR_SYSCALL] = {
+    SYSCALL(write, sys_write, 3),
+    SYSCALL(read, sys_read, 3),
+    SYSCALL(exit, sys_exit, 1),
+    SYSCALL(sched_yield, sys_sched_yield, 0),
+    SYSCALL(gettimeofday, sys_gettimeofday, 2),
+    SYSCALL(getpid, sys_getpid, 0),
+    SYSCALL(getppid, sys_getppid, 0),
+    SYSCALL(clone, sys_clone, 0),  // fork
+    SYSCALL(execve, sys_exec, 1),
+    SYSCALL(wait4, sys_wait, 2),
+    SYSCALL(nanosleep, sys_nanosleep, 2),
+    SYSCALL(setpriority, sys_set_priority, 1),
+    SYSCALL(spawn, sys_spawn, 1),
+    SYSCALL(sbrk, sys_sbrk, 1),
+    SYSCALL(mmap, sys_mmap, 6),
+    SYSCALL(munmap, sys_munmap, 2),
+    SYSCALL(io_uring_setup, sys_io_uring_setup, 0),
+    SYSCALL(io_uring_enter, sys_io_uring_enter, 1),
+};
+
 void syscall() {
     struct trapframe *trapframe = curr_proc()->trapframe;
-    int id                      = trapframe->a7, ret;
-    uint64 args[6]              = {trapframe->a0, trapframe->a1, trapframe->a2, trapframe->a3, trapframe->a4, trapframe->a5};
-    tracef("syscall %d args = [%x, %x, %x, %x, %x, %x]", id, args[0], args[1], args[2], args[3], args[4], args[5]);
-    switch (id) {
-        case SYS_write:
-            ret = sys_write(args[0], args[1], args[2]);
-            break;
-        case SYS_read:
-            ret = sys_read(args[0], args[1], args[2]);
-            break;
-        case SYS_exit:
-            sys_exit(args[0]);
-            // __builtin_unreachable();
-        case SYS_sched_yield:
-            ret = sys_sched_yield();
-            break;
-        case SYS_gettimeofday:
-            ret = sys_gettimeofday(args[0], args[1]);
-            break;
-        case SYS_getpid:
-            ret = sys_getpid();
-            break;
-        case SYS_getppid:
-            ret = sys_getppid();
-            break;
-        case SYS_clone:  // SYS_fork
-            ret = sys_clone();
-            break;
-        case SYS_execve:
-            ret = sys_exec(args[0]);
+    uint64 id                   = trapframe->a7;
+
+    if (id >= NR_SYSCALL || syscall_table[id].name == NULL) {
+        errorf("unknown syscall %d", (int)id);
+        trapframe->a0 = -1;
+        return;
+    }
+
+    const struct syscall_desc *sc = &syscall_table[id];
+    uint64 ret;
+    switch (sc->nargs) {
+        case 0:
+            ret = sc->fn0();
             break;
-        case SYS_wait4:
-            ret = sys_wait(args[0], args[1]);
+        case 1:
+            ret = sc->fn1(trapframe->a0);
             break;
-        case SYS_spawn:
-            ret = sys_spawn(args[0]);
+        case 2:
+            ret = sc->fn2(trapframe->a0, trapframe->a1);
             break;
-        case SYS_sbrk:
-            ret = sys_sbrk(args[0]);
+        case 3:
+            ret = sc->fn3(trapframe->a0, trapframe->a1, trapframe->a2);
             break;
         default:
-            ret = -1;
-            errorf("unknown syscall %d", id);
+            ret = sc->fn6(trapframe->a0, trapframe->a1, trapframe->a2, trapframe->a3, trapframe->a4, trapframe->a5);
+            break;
     }
+    // one trace line per syscall, after it returns.
+    tracef("syscall %s/%d = %d", sc->name, sc->nargs, ret);
     trapframe->a0 = ret;
-    tracef("syscall ret %d", ret);
 }
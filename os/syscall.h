@@ -2,7 +2,26 @@
 #define SYSCALL_H
 
 #include "syscall_ids.h"
+#include "types.h"
+
+// mmap() prot
+#define PROT_READ  0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC  0x4
+
+// mmap() flags, only private anonymous mappings are supported.
+#define MAP_SHARED    0x01
+#define MAP_PRIVATE   0x02
+#define MAP_FIXED     0x10
+#define MAP_ANONYMOUS 0x20
 
 void syscall();
 
+// handlers shared with uring.c and bench.c
+uint64 sys_write(uint64 fd, uint64 va, uint64 len);
+uint64 sys_read(uint64 fd, uint64 va, uint64 len);
+uint64 sys_sched_yield(void);
+uint64 sys_gettimeofday(uint64 val, uint64 _tz);
+uint64 sys_getppid(void);
+
 #endif // SYSCALL_H
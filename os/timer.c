@@ -1,5 +1,6 @@
 #include "timer.h"
 
+#include "defs.h"
 #include "riscv.h"
 #include "sbi.h"
 
@@ -8,8 +9,208 @@ uint64 get_cycle() {
     return r_time();
 }
 
+// The page mapped at VDSO_DATA, it must not share the page with other kernel data.
+static union {
+    struct vdso_data data;
+    char page[PGSIZE];
+} vdso_page __attribute__((aligned(PGSIZE))) = {
+    .data = {.version = 1, .timebase_freq = CPU_FREQ},
+};
+
+uint64 __pa vdso_data_pa() {
+    return KIVA_TO_PA(&vdso_page);
+}
+
+/// ticks since boot, the unit of timer expiry
+uint64 get_ticks() {
+    return get_cycle() / (CPU_FREQ / TICKS_PER_SEC);
+}
+
+// Hierarchical timer wheel, shared by all harts.
+// Level n has TW_SIZE slots, each covering TW_SIZE^n ticks. A timer is placed in the
+//  lowest level that can hold its expiry, and moved down (cascaded) when the lower level
+//  wraps around. timer_add() and timer_del() are O(1).
+// The wheel is advanced by timer_run() on timer interrupts, catching up the ticks skipped
+//  by stretched or idle timeslices (see sched.c).
+#define TW_BITS   (6)
+#define TW_SIZE   (1 << TW_BITS)
+#define TW_MASK   (TW_SIZE - 1)
+#define TW_LEVELS (3)
+#define TW_MAX    ((1ULL << (TW_BITS * TW_LEVELS)) - 1)
+
+#define TW_INDEX(expires, level) (((expires) >> (TW_BITS * (level))) & TW_MASK)
+
+static struct {
+    spinlock_t lock;
+    uint64 clk;  // all timers expiring before clk have been run
+    struct timer *slots[TW_LEVELS][TW_SIZE];
+    struct timer *expired;  // expired, waiting for timer_run() to call them
+    int pending;            // timers in slots and expired
+} wheel;
+
+static void timer_link(struct timer **head, struct timer *t) {
+    t->next  = *head;
+    t->pprev = head;
+    if (*head)
+        (*head)->pprev = &t->next;
+    *head = t;
+}
+
+static void timer_unlink(struct timer *t) {
+    *t->pprev = t->next;
+    if (t->next)
+        t->next->pprev = t->pprev;
+    t->next  = NULL;
+    t->pprev = NULL;
+}
+
+// Caller should hold wheel.lock.
+static void wheel_insert(struct timer *t) {
+    uint64 expires = t->expires;
+    if (expires < wheel.clk)
+        expires = wheel.clk;
+    uint64 delta = expires - wheel.clk;
+    if (delta > TW_MAX) {
+        // put it at the farthest slot, it is re-inserted when cascaded.
+        delta   = TW_MAX;
+        expires = wheel.clk + TW_MAX;
+    }
+
+    int level = 0;
+    while (delta >= (1ULL << (TW_BITS * (level + 1))))
+        level++;
+    timer_link(&wheel.slots[level][TW_INDEX(expires, level)], t);
+    wheel.pending++;
+}
+
+// Move the timers in slot `index` of `level` to lower levels.
+// Return index, the caller cascades the next level when it is 0.
+static int cascade(int level, int index) {
+    struct timer *t = wheel.slots[level][index];
+    wheel.slots[level][index] = NULL;
+    while (t) {
+        struct timer *next = t->next;
+        wheel.pending--;
+        wheel_insert(t);
+        t = next;
+    }
+    return index;
+}
+
+void timer_setup(struct timer *t, void (*fn)(void *), void *arg) {
+    t->next  = NULL;
+    t->pprev = NULL;
+    t->state = TIMER_IDLE;
+    t->fn    = fn;
+    t->arg   = arg;
+}
+
+// Arm t to run at tick `expires`, re-arm it if it is pending.
+void timer_add(struct timer *t, uint64 expires) {
+    acquire(&wheel.lock);
+    if (t->state == TIMER_PENDING) {
+        timer_unlink(t);
+        wheel.pending--;
+    }
+    t->expires = expires;
+    t->state   = TIMER_PENDING;
+    wheel_insert(t);
+    release(&wheel.lock);
+}
+
+// Cancel t, and wait for its callback if it is running on another hart.
+// Must not be called with locks that the callback takes.
+// Return 1 if t was pending.
+int timer_del(struct timer *t) {
+    int ret = 0;
+    acquire(&wheel.lock);
+    while (t->state == TIMER_RUNNING) {
+        release(&wheel.lock);
+        acquire(&wheel.lock);
+    }
+    if (t->state == TIMER_PENDING) {
+        timer_unlink(t);
+        wheel.pending--;
+        t->state = TIMER_IDLE;
+        ret      = 1;
+    }
+    release(&wheel.lock);
+    return ret;
+}
+
+// Advance the wheel to now and run the expired timers, called on timer interrupts.
+// Callbacks run with interrupts off and without wheel.lock.
+void timer_run() {
+    uint64 now = get_ticks();
+    // lockless check, most ticks have nothing to do.
+    if (*(volatile uint64 *)&wheel.clk > now)
+        return;
+
+    acquire(&wheel.lock);
+    while (wheel.clk <= now) {
+        int index = TW_INDEX(wheel.clk, 0);
+        if (index == 0 && cascade(1, TW_INDEX(wheel.clk, 1)) == 0)
+            cascade(2, TW_INDEX(wheel.clk, 2));
+
+        struct timer *t = wheel.slots[0][index];
+        wheel.slots[0][index] = NULL;
+        while (t) {
+            struct timer *next = t->next;
+            timer_link(&wheel.expired, t);
+            t = next;
+        }
+        wheel.clk++;
+    }
+
+    while (wheel.expired) {
+        struct timer *t = wheel.expired;
+        timer_unlink(t);
+        wheel.pending--;
+        t->state = TIMER_RUNNING;
+        release(&wheel.lock);
+        t->fn(t->arg);
+        acquire(&wheel.lock);
+        // the callback may have re-armed t.
+        if (t->state == TIMER_RUNNING)
+            t->state = TIMER_IDLE;
+    }
+    release(&wheel.lock);
+}
+
+// Return how many ticks from now the next timer may expire, at least 1, or -1 if there is no timer.
+// Timers in higher levels are reported at their cascade point, so this can be early, never late.
+uint64 timer_next_event() {
+    uint64 now = get_ticks(), ret = -1ULL;
+    acquire(&wheel.lock);
+    if (wheel.pending > 0) {
+        uint64 clk = wheel.clk;
+        // the next cascade from level 1.
+        ret = TW_SIZE - TW_INDEX(clk, 0);
+        for (uint64 i = 0; i < ret; i++) {
+            if (wheel.slots[0][TW_INDEX(clk + i, 0)]) {
+                ret = i;
+                break;
+            }
+        }
+        if (wheel.expired)
+            ret = 0;
+        ret = clk + ret > now ? clk + ret - now : 1;
+    }
+    release(&wheel.lock);
+    return ret;
+}
+
 /// Enable timer interrupt
 void timer_init() {
+    // the boot hart sets up the wheel before others start.
+    static int wheel_inited = 0;
+    if (!wheel_inited) {
+        wheel_inited = 1;
+        spinlock_init(&wheel.lock, "timer");
+        wheel.clk = get_ticks();
+    }
+    // Let user mode read the clock, see vdso.S
+    w_scounteren(SCOUNTEREN_TM);
     // Enable supervisor timer interrupt
     w_sie(r_sie() | SIE_STIE);
     set_next_timer();
@@ -17,6 +218,16 @@ void timer_init() {
 
 // /// Set the next timer interrupt
 void set_next_timer() {
+    set_timer_ticks(1);
+}
+
+/// Cancel the timer interrupt, the pending one is cleared as well
+void stop_timer() {
+    set_timer(-1ULL);
+}
+
+/// Set the next timer interrupt after `ticks` ticks
+void set_timer_ticks(uint64 ticks) {
     const uint64 timebase = CPU_FREQ / TICKS_PER_SEC;
-    set_timer(get_cycle() + timebase);
-}
\ No newline at end of file
+    set_timer(get_cycle() + ticks * timebase);
+}
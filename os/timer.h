@@ -7,13 +7,48 @@
 // QEMU
 #define CPU_FREQ (12500000)
 
+#define TIMER_IDLE    (0)
+#define TIMER_PENDING (1)
+#define TIMER_RUNNING (2)
+
+struct timer {
+    struct timer *next, **pprev;
+    uint64 expires;  // in ticks, see get_ticks()
+    int state;       // TIMER_*
+    void (*fn)(void *);
+    void *arg;
+};
+
 uint64 get_cycle();
+uint64 get_ticks();
 void timer_init();
 void set_next_timer();
+void set_timer_ticks(uint64 ticks);
+void stop_timer();
+
+void timer_setup(struct timer *t, void (*fn)(void *), void *arg);
+void timer_add(struct timer *t, uint64 expires);
+int timer_del(struct timer *t);
+void timer_run();
+uint64 timer_next_event();
 
 typedef struct {
     uint64 sec;   // 自 Unix 纪元起的秒数
     uint64 usec;  // 微秒数
 } TimeVal;
 
+typedef struct {
+    uint64 sec;
+    uint64 nsec;
+} TimeSpec;
+
+// Clock calibration, mapped read-only at VDSO_DATA in every process.
+// vdso.S depends on the layout.
+struct vdso_data {
+    uint64 version;
+    uint64 timebase_freq;  // rdtime increments per second
+};
+
+uint64 vdso_data_pa();
+
 #endif  // TIMER_H
\ No newline at end of file
@@ -19,6 +19,37 @@ void plic_handle() {
         plic_complete(irq);
 }
 
+// Handle a page fault on user address addr, taken by user mode or by copy_*_user.
+// Populate lazy pages, break copy-on-write, and set A/D bits.
+// Return 0 if the access can be retried.
+static int user_page_fault(struct mm *mm, uint64 code, uint64 addr) {
+    if (!IS_USER_VA(addr))
+        return -1;
+    acquire(&mm->lock);
+
+    int ret    = -1;
+    pte_t *pte = walk(mm, addr, 0);
+    // first access to a lazy page, populate it and check the permission below.
+    if ((pte == NULL || !(*pte & PTE_V)) && mm_lazy_fault(mm, addr) == 0)
+        pte = walk(mm, addr, 0);
+    if (code == StorePageFault && pte != NULL && (*pte & PTE_COW)) {
+        ret = mm_cow_fault(mm, addr);
+    } else {
+        // VisionFive2 does not set A/D bits in hardware, see kvm.c
+        uint64 perm = code == StorePageFault ? PTE_W : (code == LoadPageFault ? PTE_R : PTE_X);
+        if (pte != NULL && (*pte & PTE_V) && (*pte & PTE_U) && (*pte & perm)) {
+            *pte |= PTE_A;
+            if (code == StorePageFault)
+                *pte |= PTE_D;
+            mm_tlb_flush_page(mm, PGROUNDDOWN(addr));
+            ret = 0;
+        }
+    }
+
+    release(&mm->lock);
+    return ret;
+}
+
 void kernel_trap(struct ktrapframe *ktf) {
     assert(!intr_get());
 
@@ -39,18 +70,41 @@ void kernel_trap(struct ktrapframe *ktf) {
         switch (exception_code) {
             case SupervisorTimer:
                 tracef("kernel timer interrupt, cycle: %d", r_time());
-                set_next_timer();
+                sched_tick();
                 // we never preempt kernel threads.
                 goto free;
             case SupervisorExternal:
                 tracef("s-external interrupt from kerneltrap!");
                 plic_handle();
                 goto free;
+            case SupervisorSoft:
+                tracef("software interrupt from kerneltrap!");
+                // we never preempt kernel threads.
+                if (ipi_handle() & IPI_RESCHEDULE)
+                    sched_ipi();
+                goto free;
             default:
                 panic("kerneltrap entered with unhandled interrupt. %p", cause);
         }
     }
 
+    // page fault in copy_*_user, see uaccess.c
+    struct mm *mm = mycpu()->uaccess_mm;
+    if (mm != NULL && (exception_code == LoadPageFault || exception_code == StorePageFault)) {
+        if (user_page_fault(mm, exception_code, r_stval()) == 0) {
+            // we keep running on mm's page table, and mm_tlb_flush_page skips this hart
+            //  without ASIDs or with a stale ASID, so the retried access may hit the old entry.
+            sfence_vma_addr(PGROUNDDOWN(r_stval()));
+            goto free;
+        }
+        uint64 fixup = uaccess_fixup(r_sepc());
+        if (fixup != 0) {
+            tracef("uaccess fault at %p, fixup %p", r_stval(), fixup);
+            w_sepc(fixup);
+            goto free;
+        }
+    }
+
     print_sysregs(true);
     print_ktrapframe(ktf);
 
@@ -98,13 +152,18 @@ void usertrap() {
         switch (code) {
             case SupervisorTimer:
                 tracef("time interrupt!");
-                set_next_timer();
-                yield();
+                if (sched_tick())
+                    yield();
                 break;
             case SupervisorExternal:
                 tracef("s-external interrupt from usertrap!");
                 plic_handle();
                 break;
+            case SupervisorSoft:
+                tracef("software interrupt from usertrap!");
+                if ((ipi_handle() & IPI_RESCHEDULE) && sched_ipi())
+                    yield();
+                break;
             default:
                 unknown_trap();
                 break;
@@ -119,19 +178,10 @@ void usertrap() {
                 break;
             case LoadPageFault:
             case StorePageFault:
-            case InstructionPageFault: {
-                uint64 addr     = r_stval();
-                pagetable_t pgt = curr_proc()->mm->pgt;
-                // vm_print(pgt);
-                pte_t *pte = walk(curr_proc()->mm, addr, 0);
-                if (pte != NULL && (*pte & PTE_V)) {
-                    *pte |= PTE_A;
-                    if (cause == StorePageFault)
-                        *pte |= PTE_D;
-                    sfence_vma();
+            case InstructionPageFault:
+                if (user_page_fault(curr_proc()->mm, code, r_stval()) == 0)
                     break;
-                }
-            }
+                // fall through
             case StoreMisaligned:
             case InstructionMisaligned:
             case LoadMisaligned:
@@ -181,10 +231,11 @@ void usertrapret() {
     w_sstatus(x);
 
     // tell trampoline.S the user page table to switch to.
-    uint64 satp  = MAKE_SATP(KVA_TO_PA(curr_proc()->mm->pgt));
+    int flush;
+    uint64 satp  = mm_satp(curr_proc()->mm, &flush);
     uint64 stvec = (TRAMPOLINE + (uservec - trampoline)) & ~0x3;
 
     uint64 fn = TRAMPOLINE + (userret - trampoline);
     tracef("return to user @%p, fn %p", trapframe->epc);
-    ((void (*)(uint64, uint64, uint64))fn)(TRAPFRAME, satp, stvec);
+    ((void (*)(uint64, uint64, uint64, uint64))fn)(TRAPFRAME, satp, stvec, flush);
 }
\ No newline at end of file
@@ -1,30 +1,74 @@
 #include "vm.h"
-#include "riscv.h"
-#include "memlayout.h"
-#include "string.h"
+#include "defs.h"
+
+// The kernel accesses user memory directly through the user mapping: it switches to
+// mm's page table, whose kernel half is shared with kernel_pagetable (see mm_create),
+// and sets SSTATUS_SUM. Page faults on user addresses are handled in kernel_trap,
+// lazy and copy-on-write pages are populated as for user accesses. Other faults resume
+// at the fixup of the faulting instruction in __ex_table, see uaccess.S.
+// Callers must not hold mm->lock, the fault handler takes it.
+
+struct exception_table_entry {
+	uint64 insn;
+	uint64 fixup;
+};
+
+extern struct exception_table_entry __ex_table_start[], __ex_table_end[];
+
+uint64 __copy_user(void *dst, const void *src, uint64 n);
+long __strncpy_user(char *dst, const char *src, uint64 max);
+
+// Return the fixup address for a fault at epc, or 0 if epc does not access user memory.
+uint64 uaccess_fixup(uint64 epc)
+{
+	for (struct exception_table_entry *e = __ex_table_start; e < __ex_table_end; e++) {
+		if (e->insn == epc)
+			return e->fixup;
+	}
+	return 0;
+}
+
+// Whether [va, va + len) is below the kernel-owned top pages of the user half.
+// Under SUM the kernel can also access non-U pages, e.g. TRAPFRAME and TRAMPOLINE,
+//  and the kernel half.
+static int access_ok(uint64 __user va, uint64 len)
+{
+	return IS_USER_VA(va) && va < TRAPFRAME && len <= TRAPFRAME - va;
+}
+
+// Switch to mm's page table and allow user accesses, return the satp to restore.
+// The kernel never preempts itself, so we stay on this cpu until uaccess_end.
+static uint64 uaccess_begin(struct mm *mm)
+{
+	uint64 ksatp = r_satp();
+	int flush;
+	w_satp(mm_satp(mm, &flush));
+	if (flush)
+		sfence_vma();
+	mycpu()->uaccess_mm = mm;
+	w_sstatus(r_sstatus() | SSTATUS_SUM);
+	return ksatp;
+}
+
+static void uaccess_end(uint64 ksatp)
+{
+	w_sstatus(r_sstatus() & ~SSTATUS_SUM);
+	mycpu()->uaccess_mm = NULL;
+	// user entries are tagged with mm's ASID, or flushed by the next switch to a user satp.
+	w_satp(ksatp);
+}
 
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
 int copy_to_user(struct mm* mm, uint64 __user dstva, char *src, uint64 len)
 {
-	uint64 n, va0, pa0;
-
-	while (len > 0) {
-		va0 = PGROUNDDOWN(dstva);
-		pa0 = walkaddr(mm, va0);
-		if (pa0 == 0)
-			return -1;
-		n = PGSIZE - (dstva - va0);
-		if (n > len)
-			n = len;
-		memmove((void *)(PA_TO_KVA(pa0) + (dstva - va0)), src, n);
-
-		len -= n;
-		src += n;
-		dstva = va0 + PGSIZE;
-	}
-	return 0;
+	if (!access_ok(dstva, len))
+		return -1;
+	uint64 ksatp = uaccess_begin(mm);
+	uint64 left = __copy_user((void *)dstva, src, len);
+	uaccess_end(ksatp);
+	return left ? -1 : 0;
 }
 
 // Copy from user to kernel.
@@ -32,61 +76,25 @@ int copy_to_user(struct mm* mm, uint64 __user dstva, char *src, uint64 len)
 // Return 0 on success, -1 on error.
 int copy_from_user(struct mm* mm, char *dst, uint64 __user srcva, uint64 len)
 {
-	uint64 n, va0, pa0;
-
-	while (len > 0) {
-		va0 = PGROUNDDOWN(srcva);
-		pa0 = walkaddr(mm, va0);
-		if (pa0 == 0)
-			return -1;
-		n = PGSIZE - (srcva - va0);
-		if (n > len)
-			n = len;
-		memmove(dst, (void *)(PA_TO_KVA(pa0) + (srcva - va0)), n);
-
-		len -= n;
-		dst += n;
-		srcva = va0 + PGSIZE;
-	}
-	return 0;
+	if (!access_ok(srcva, len))
+		return -1;
+	uint64 ksatp = uaccess_begin(mm);
+	uint64 left = __copy_user(dst, (void *)srcva, len);
+	uaccess_end(ksatp);
+	return left ? -1 : 0;
 }
 
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
 // until a '\0', or max.
-// Return 0 on success, -1 on error.
+// Return the length of the string on success, -1 on error.
 int copystr_from_user(struct mm* mm, char *dst, uint64 __user srcva, uint64 max)
 {
-	uint64 n, va0, pa0, kva0;
-	int got_null = 0, len = 0;
-
-	while (got_null == 0 && max > 0) {
-		va0 = PGROUNDDOWN(srcva);
-		pa0 = walkaddr(mm, va0);
-		if (pa0 == 0)
-			return -1;
-		n = PGSIZE - (srcva - va0);
-		if (n > max)
-			n = max;
-
-        kva0 = PA_TO_KVA(pa0);
-		char *p = (char *)(kva0 + (srcva - va0));
-		while (n > 0) {
-			if (*p == '\0') {
-				*dst = '\0';
-				got_null = 1;
-				break;
-			} else {
-				*dst = *p;
-			}
-			--n;
-			--max;
-			p++;
-			dst++;
-			len++;
-		}
-
-		srcva = va0 + PGSIZE;
-	}
+	if (!IS_USER_VA(srcva))
+		return -1;
+	max = MIN(max, MAXVA - srcva);
+	uint64 ksatp = uaccess_begin(mm);
+	long len = __strncpy_user(dst, (char *)srcva, max);
+	uaccess_end(ksatp);
 	return len;
 }
@@ -0,0 +1,91 @@
+#include "uring.h"
+
+#include "defs.h"
+#include "syscall.h"
+#include "timer.h"
+
+_Static_assert(sizeof(struct uring) <= PGSIZE, "struct uring should fit in the ring page");
+
+// Map the ring of p at URING, or reset it if it exists (e.g. after exec).
+// Return the user address of the ring, 0 if out of memory.
+uint64 uring_setup(struct proc *p) {
+    if (p->uring == NULL) {
+        void *__pa pa = kallocpage_zeroed();
+        if (pa == NULL)
+            return 0;
+        acquire(&p->mm->lock);
+        p->vma_uring = mm_mappagesat(p->mm, URING, (uint64)pa, PTE_A | PTE_D | PTE_R | PTE_W | PTE_U, false);
+        release(&p->mm->lock);
+        if (p->vma_uring == NULL) {
+            kfreepage(pa);
+            return 0;
+        }
+        p->uring = (struct uring *)PA_TO_KVA(pa);
+    } else {
+        memset(p->uring, 0, sizeof(struct uring));
+    }
+    p->uring->sq_entries = URING_SQ_ENTRIES;
+    p->uring->cq_entries = URING_CQ_ENTRIES;
+    return URING;
+}
+
+void uring_free(struct proc *p) {
+    mm_unmappagesat(p->vma_uring, true);
+    p->vma_uring = NULL;
+    p->uring     = NULL;
+}
+
+static int64 uring_op(struct uring_sqe *sqe) {
+    switch (sqe->opcode) {
+        case URING_OP_NOP:
+            return 0;
+        case URING_OP_WRITE:
+            // lengths are 32-bit in write(), do not truncate.
+            if (sqe->len > 0xffffffffULL)
+                return -1;
+            return sys_write(sqe->fd, sqe->addr, sqe->len);
+        case URING_OP_READ:
+            if (sqe->len > 0xffffffffULL)
+                return -1;
+            return sys_read(sqe->fd, sqe->addr, sqe->len);
+        case URING_OP_YIELD:
+            return sys_sched_yield();
+        case URING_OP_GETTIME:
+            return sys_gettimeofday(sqe->addr, 0);
+        default:
+            return -1;
+    }
+}
+
+// Execute up to to_submit queued operations of p in order, and post their completions.
+// Stop early when the completion ring is full.
+// Return the number of operations consumed, -1 if p has no ring.
+int uring_enter(struct proc *p, uint to_submit) {
+    struct uring *r = p->uring;
+    if (r == NULL)
+        return -1;
+
+    // the process writes the ring concurrently, read each shared index once.
+    uint32 sq_head = r->sq_head;
+    uint32 cq_tail = r->cq_tail;
+    int n          = 0;
+    while (n < to_submit) {
+        uint32 sq_tail = *(volatile uint32 *)&r->sq_tail;
+        uint32 cq_head = *(volatile uint32 *)&r->cq_head;
+        if (sq_head == sq_tail || cq_tail - cq_head >= URING_CQ_ENTRIES)
+            break;
+        MEMORY_FENCE();  // read the sqe after sq_tail
+
+        struct uring_sqe sqe = r->sqes[sq_head % URING_SQ_ENTRIES];
+        r->sq_head           = ++sq_head;
+
+        struct uring_cqe *cqe = &r->cqes[cq_tail % URING_CQ_ENTRIES];
+        cqe->user_data        = sqe.user_data;
+        cqe->res              = uring_op(&sqe);
+        MEMORY_FENCE();  // publish the cqe before cq_tail
+        r->cq_tail = ++cq_tail;
+        n++;
+    }
+    tracef("uring_enter: %d of %d", n, to_submit);
+    return n;
+}
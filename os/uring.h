@@ -0,0 +1,53 @@
+#ifndef URING_H
+#define URING_H
+
+#include "types.h"
+
+// A submission/completion ring shared with user mode, mapped at URING.
+// The process queues operations in sqes[] and advances sq_tail, then one
+//  io_uring_enter() executes them in order, each posting a completion in cqes[].
+// Indexes are free-running, the slot of index i is i & (ENTRIES - 1).
+// The layout is part of the user ABI.
+
+#define URING_SQ_ENTRIES 64
+#define URING_CQ_ENTRIES 64
+
+// uring_sqe->opcode
+#define URING_OP_NOP     0
+#define URING_OP_WRITE   1  // write(fd, addr, len)
+#define URING_OP_READ    2  // read(fd, addr, len)
+#define URING_OP_YIELD   3  // sched_yield()
+#define URING_OP_GETTIME 4  // gettimeofday((TimeVal *)addr, NULL)
+
+struct uring_sqe {
+    uint8 opcode;
+    uint8 pad[3];
+    int32 fd;
+    uint64 addr;
+    uint64 len;
+    uint64 user_data;  // copied to the completion
+};
+
+struct uring_cqe {
+    uint64 user_data;
+    int64 res;  // return value of the operation, -1 for unknown opcodes
+};
+
+struct uring {
+    uint32 sq_head;  // advanced by the kernel
+    uint32 sq_tail;  // advanced by the process
+    uint32 cq_head;  // advanced by the process
+    uint32 cq_tail;  // advanced by the kernel
+    uint32 sq_entries;
+    uint32 cq_entries;
+    uint64 pad[5];
+    struct uring_sqe sqes[URING_SQ_ENTRIES];
+    struct uring_cqe cqes[URING_CQ_ENTRIES];
+};
+
+struct proc;
+uint64 uring_setup(struct proc *p);
+void uring_free(struct proc *p);
+int uring_enter(struct proc *p, uint to_submit);
+
+#endif  // URING_H
@@ -2,12 +2,159 @@
 
 #include "defs.h"
 #include "kalloc.h"
+#include "sbi.h"
 
 allocator_t mm_allocator;
 allocator_t vma_allocator;
 
+// ASID management.
+// Each mm gets an ASID on its first return to user mode, so switching satp does not flush the TLB.
+// mm->asid is (generation << ASID_GEN_SHIFT) | asid. ASIDs are handed out sequentially,
+//  when they run out, the generation is bumped and every cpu flushes its whole TLB once
+//  before running a new-generation ASID (see mm_satp). mm with a stale generation get a new ASID.
+// ASID 0 is used by kernel_pagetable.
+#define ASID_GEN_SHIFT	16
+#define ASID_TLB_RANGE	32	// flush the whole ASID for ranges larger than this many pages
+
+static uint64 asid_bits;	// ASID bits implemented by the hart, 0 if ASID is not supported
+static volatile uint64 asid_generation = 1;
+static uint64 asid_next = 1;
+static spinlock_t asid_lock;
+
+static void asid_init()
+{
+	// the implemented ASID bits read back as ones.
+	uint64 satp = r_satp();
+	w_satp(satp | SATP_ASID_MASK);
+	uint64 asid = (r_satp() & SATP_ASID_MASK) >> SATP_ASID_SHIFT;
+	w_satp(satp);
+	sfence_vma();
+
+	while (asid_bits < 16 && (asid & (1ULL << asid_bits)))
+		asid_bits++;
+	spinlock_init(&asid_lock, "asid");
+	infof("ASID bits: %d", asid_bits);
+}
+
+static inline int asid_valid(struct mm *mm)
+{
+	return (mm->asid >> ASID_GEN_SHIFT) == asid_generation;
+}
+
+static void asid_alloc(struct mm *mm)
+{
+	acquire(&asid_lock);
+	if (!asid_valid(mm)) {
+		if (asid_next >= (1ULL << asid_bits)) {
+			// rollover, cpus flush their TLB in mm_satp.
+			asid_generation++;
+			asid_next = 1;
+		}
+		// no cpu has TLB entries of a fresh ASID.
+		mm->tlb_stale_cpus = 0;
+		mm->asid = (asid_generation << ASID_GEN_SHIFT) | asid_next++;
+	}
+	release(&asid_lock);
+}
+
+// Return the satp value to switch to mm on this cpu, right before returning to user mode
+//  or accessing user memory (see uaccess.c).
+// Set *flush if the whole TLB should be flushed after switching (no ASID support).
+uint64 mm_satp(struct mm *mm, int *flush)
+{
+	struct cpu *c = mycpu();
+
+	if (!(mm->cpus_active & (1ULL << c->cpuid))) {
+		__sync_fetch_and_or(&mm->cpus_active, 1ULL << c->cpuid);
+		// pairs with mm_tlb_flush_range: either we see the stale mark, or it sees us active.
+		MEMORY_FENCE();
+	}
+
+	if (asid_bits == 0) {
+		*flush = 1;
+		return MAKE_SATP(KVA_TO_PA(mm->pgt));
+	}
+	*flush = 0;
+
+	if (!asid_valid(mm))
+		asid_alloc(mm);
+	uint64 gen = mm->asid >> ASID_GEN_SHIFT;
+	uint64 asid = mm->asid & ((1ULL << asid_bits) - 1);
+	if (c->asid_generation != gen) {
+		// the ASIDs have been recycled since our last flush.
+		sfence_vma();
+		c->asid_generation = gen;
+		__sync_fetch_and_and(&mm->tlb_stale_cpus, ~(1ULL << c->cpuid));
+	} else if (mm->tlb_stale_cpus & (1ULL << c->cpuid)) {
+		// mm's page table was changed on another cpu.
+		__sync_fetch_and_and(&mm->tlb_stale_cpus, ~(1ULL << c->cpuid));
+		sfence_vma_asid(asid);
+	}
+	return MAKE_SATP_ASID(KVA_TO_PA(mm->pgt), asid);
+}
+
+// mm is no longer running on this cpu, called when its process is switched out.
+void mm_deactivate(struct mm *mm)
+{
+	__sync_fetch_and_and(&mm->cpus_active, ~(1ULL << cpuid()));
+}
+
+// Convert a cpumask to a mask of mhartid for SBI calls.
+static uint64 cpus_to_hartmask(uint64 cpus)
+{
+	uint64 mask = 0;
+	for (int i = 0; i < NCPU; i++) {
+		if (cpus & (1ULL << i))
+			mask |= 1ULL << getcpu(i)->mhart_id;
+	}
+	return mask;
+}
+
+// Called after the PTEs in [start, end) of mm have changed.
+// This cpu is fenced now, cpus running mm are fenced with one SBI remote fence,
+//  and the others flush mm's ASID before running it again (see mm_satp).
+void mm_tlb_flush_range(struct mm *mm, uint64 start, uint64 end)
+{
+	uint64 self = 1ULL << cpuid();
+	int whole = (end - start) / PGSIZE > ASID_TLB_RANGE;
+
+	if (asid_bits == 0) {
+		// without ASID, this cpu flushes the whole TLB on every return to user mode.
+		MEMORY_FENCE();
+		uint64 remote = mm->cpus_active & ~self;
+		if (remote)
+			sbi_remote_sfence_vma(cpus_to_hartmask(remote), 0, whole ? 0 : start, whole ? -1UL : end - start);
+		return;
+	}
+
+	__sync_fetch_and_or(&mm->tlb_stale_cpus, ((1ULL << NCPU) - 1) & ~self);
+	MEMORY_FENCE();
+	uint64 remote = mm->cpus_active & ~self;
+	uint64 asid = mm->asid & ((1ULL << asid_bits) - 1);
+	// a cpu running mm may still use an ASID of stale generation, fence it by number.
+	if (remote && mm->asid != 0)
+		sbi_remote_sfence_vma_asid(cpus_to_hartmask(remote), 0, whole ? 0 : start, whole ? -1UL : end - start, asid);
+
+	// an ASID of stale generation is never used by this cpu again without a full flush.
+	if (!asid_valid(mm))
+		return;
+	if (whole) {
+		sfence_vma_asid(asid);
+		return;
+	}
+	for (uint64 va = start; va < end; va += PGSIZE)
+		sfence_vma_addr_asid(va, asid);
+}
+
+// Called after the PTE of va in mm has changed.
+void mm_tlb_flush_page(struct mm *mm, uint64 va)
+{
+	mm_tlb_flush_range(mm, va, va + PGSIZE);
+}
+
 void uvm_init()
 {
+	asid_init();
 	allocator_init(&mm_allocator, "mm", sizeof(struct mm), 16384);
 	allocator_init(&vma_allocator, "vma", sizeof(struct vma), 16384);
 }
@@ -34,17 +181,35 @@ pte_t *walk(struct mm *mm, uint64 va, int alloc)
 	for (int level = 2; level > 0; level--) {
 		pte_t *pte = &pagetable[PX(level, va)];
 		if (*pte & PTE_V) {
+			// a 2 MiB page, see mm_lazy_fault.
+			if (*pte & PTE_HUGE)
+				return pte;
 			pagetable = (pagetable_t)PA_TO_KVA(PTE2PA(*pte));
 		} else {
-			if (!alloc || (pagetable = (pde_t *)PA_TO_KVA(kallocpage())) == 0)
+			uint64 __pa pa;
+			if (!alloc || (pa = (uint64)kallocpage_zeroed()) == 0)
 				return 0;
-			memset(pagetable, 0, PGSIZE);
-			*pte = PA2PTE(KVA_TO_PA(pagetable)) | PTE_V;
+			pagetable = (pagetable_t)PA_TO_KVA(pa);
+			*pte = PA2PTE(pa) | PTE_V;
 		}
 	}
 	return &pagetable[PX(0, va)];
 }
 
+// Return the address of the level-1 PTE for va, where a 2 MiB page can be mapped.
+static pte_t *walk_pmd(struct mm *mm, uint64 va, int alloc)
+{
+	pte_t *pte = &mm->pgt[PX(2, va)];
+	if (!(*pte & PTE_V)) {
+		uint64 __pa pa;
+		if (!alloc || (pa = (uint64)kallocpage_zeroed()) == 0)
+			return 0;
+		*pte = PA2PTE(pa) | PTE_V;
+	}
+	pagetable_t pagetable = (pagetable_t)PA_TO_KVA(PTE2PA(*pte));
+	return &pagetable[PX(1, va)];
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
@@ -68,6 +233,8 @@ uint64 __pa walkaddr(struct mm *mm, uint64 va)
 		return 0;
 	}
 	pa = PTE2PA(*pte);
+	if (*pte & PTE_HUGE)
+		pa += va & (PGSIZE_2M - 1);
 	return pa;
 }
 
@@ -83,15 +250,21 @@ uint64 useraddr(struct mm *mm, uint64 va)
 struct mm *mm_create()
 {
 	struct mm *mm = kalloc(&mm_allocator);
+	if (mm == NULL)
+		return NULL;
 	memset(mm, 0, sizeof(*mm));
 	spinlock_init(&mm->lock, "mm");
 	mm->vma = NULL;
 	mm->refcnt = 1;
 
-	mm->pgt = (pagetable_t)PA_TO_KVA(kallocpage());
-	if (!mm->pgt)
+	void *__pa pgt = kallocpage_zeroed();
+	if (!pgt)
 		goto free_mm;
-	memset(mm->pgt, 0, PGSIZE);
+	mm->pgt = (pagetable_t)PA_TO_KVA(pgt);
+	// share the kernel half, so that the kernel can run on mm's page table to access
+	// user memory, see uaccess.c. It is not changed after boot.
+	for (int i = PX(2, KERNEL_DIRECT_MAPPING_BASE); i < 512; i++)
+		mm->pgt[i] = kernel_pagetable[i];
 
 	return mm;
 
@@ -103,11 +276,23 @@ free_mm:
 struct vma *mm_create_vma(struct mm *mm)
 {
 	struct vma *vma = kalloc(&vma_allocator);
+	if (vma == NULL)
+		return NULL;
 	memset(vma, 0, sizeof(*vma));
 	vma->owner = mm;
 	return vma;
 }
 
+// Find the vma in mm->vma containing va, or NULL.
+struct vma *mm_find_vma(struct mm *mm, uint64 va)
+{
+	for (struct vma *vma = mm->vma; vma; vma = vma->next) {
+		if (vma->vm_start <= va && va < vma->vm_end)
+			return vma;
+	}
+	return NULL;
+}
+
 void mm_free_pages(struct mm *mm)
 {
 	struct vma *next, *vma = mm->vma;
@@ -130,22 +315,60 @@ void mm_free(struct mm *mm)
 	}
 }
 
-void freevma(struct vma *vma, int free_phy_page)
+// Unmap [start, end) of vma, and free the physical pages if free_phy_page.
+static void unmap_pages(struct vma *vma, uint64 start, uint64 end, int free_phy_page)
 {
-	assert(PGALIGNED(vma->vm_start) && PGALIGNED(vma->vm_end));
-
 	struct mm *mm = vma->owner;
-	for (uint64 va = vma->vm_start; va < vma->vm_end; va += PGSIZE) {
+	for (uint64 va = start; va < end; va += PGSIZE) {
 		pte_t *pte = walk(mm, va, false);
-		if (!pte)
-			warnf("free unmapped address %p", va);
-		else {
+		if (!pte || !(*pte & PTE_V)) {
+			// lazy pages may never be touched.
+			if (!(vma->vm_flags & VMA_LAZY))
+				warnf("free unmapped address %p", va);
+		} else if (*pte & PTE_HUGE) {
+			// mm_munmap never splits a 2 MiB page.
+			assert(IS_ALIGNED(va, PGSIZE_2M) && end - va >= PGSIZE_2M);
+			if (free_phy_page)
+				kfreepages((void *)PTE2PA(*pte), KPAGE_MAX_ORDER);
+			*pte = 0;
+			va += PGSIZE_2M - PGSIZE;
+		} else {
 			if (free_phy_page)
 				kfreepage((void *)PTE2PA(*pte));
 			*pte = 0;
 		}
 	}
-	sfence_vma();
+	mm_tlb_flush_range(mm, start, end);
+}
+
+void freevma(struct vma *vma, int free_phy_page)
+{
+	assert(PGALIGNED(vma->vm_start) && PGALIGNED(vma->vm_end));
+	unmap_pages(vma, vma->vm_start, vma->vm_end, free_phy_page);
+}
+
+// Move the end of a VMA_LAZY vma to new_end.
+// Growing only extends the range, pages are populated on first access.
+// Shrinking unmaps and frees the pages beyond new_end.
+// Caller should hold vma->owner->lock.
+// Return 0 on success, -1 if the new range overlaps another vma or leaves the user space.
+int mm_resize_vma(struct vma *vma, uint64 new_end)
+{
+	assert(PGALIGNED(new_end));
+	assert(vma->vm_flags & VMA_LAZY);
+
+	if (new_end < vma->vm_start || !IS_USER_VA(new_end))
+		return -1;
+	if (new_end > vma->vm_end) {
+		for (struct vma *v = vma->owner->vma; v; v = v->next) {
+			if (v != vma && v->vm_start < new_end && vma->vm_end < v->vm_end)
+				return -1;
+		}
+	} else if (new_end < vma->vm_end) {
+		unmap_pages(vma, new_end, vma->vm_end, true);
+	}
+	vma->vm_end = new_end;
+	return 0;
 }
 
 /**
@@ -153,6 +376,7 @@ void freevma(struct vma *vma, int free_phy_page)
  * Addresses must be aligned to PGSIZE.
  * Physical pages are allocated automatically.
  * Caller should then use walkaddr to resolve the mapped PA, and do initialization.
+ * If @vma is VMA_LAZY, nothing is allocated here, pages are zero-filled on first access (see mm_lazy_fault).
  * 
  * @param vma 
  * @return int 
@@ -172,6 +396,9 @@ int mm_mappages(struct vma *vma)
 	void *pa;
 	pte_t *pte;
 
+	if (vma->vm_flags & VMA_LAZY)
+		goto link;
+
 	for (va = vma->vm_start; va < vma->vm_end; va += PGSIZE) {
 		if ((pte = walk(mm, va, 1)) == 0) {
 			errorf("pte invalid, va = %p", va);
@@ -189,8 +416,9 @@ int mm_mappages(struct vma *vma)
 		// memset((void *)PA_TO_KVA(pa), 0, PGSIZE);
 		*pte = PA2PTE(pa) | vma->pte_flags | PTE_V;
 	}
-	sfence_vma();
+	mm_tlb_flush_range(mm, vma->vm_start, vma->vm_end);
 
+link:
 	vma->next = mm->vma;
 	mm->vma = vma;
 
@@ -202,6 +430,8 @@ struct vma *mm_mappagesat(struct mm *mm, uint64 va, uint64 __pa pa, uint64 flags
 	tracef("mappagesat: %p -> %p", va, pa);
 
 	struct vma *vma = kalloc(&vma_allocator);
+	if (vma == NULL)
+		return NULL;
 	memset(vma, 0, sizeof(*vma));
 	vma->owner = mm;
 	vma->pte_flags = flags;
@@ -212,15 +442,17 @@ struct vma *mm_mappagesat(struct mm *mm, uint64 va, uint64 __pa pa, uint64 flags
 
 	if ((pte = walk(mm, va, 1)) == 0) {
 		errorf("pte invalid, va = %p", va);
+		kfree(&vma_allocator, vma);
 		return NULL;
 	}
 	if (*pte & PTE_V) {
 		errorf("remap %p", va);
 		vm_print(mm->pgt);
+		kfree(&vma_allocator, vma);
 		return NULL;
 	}
 	*pte = PA2PTE(pa) | vma->pte_flags | PTE_V;
-	sfence_vma();
+	mm_tlb_flush_page(mm, va);
 
 	if (add_linked_list) {
 		vma->next = mm->vma;
@@ -230,8 +462,20 @@ struct vma *mm_mappagesat(struct mm *mm, uint64 va, uint64 __pa pa, uint64 flags
 	return vma;
 }
 
+// Undo mm_mappagesat(..., false): unmap the page and free vma itself.
+void mm_unmappagesat(struct vma *vma, int free_phy_page)
+{
+	if (vma == NULL)
+		return;
+	freevma(vma, free_phy_page);
+	kfree(&vma_allocator, vma);
+}
+
 // Used in fork.
-// Copy the pagetable page and all the user pages.
+// Share all the user pages with the new mm, copy-on-write:
+//  writable pages are mapped read-only with PTE_COW in both mm, and each shared physical page
+//  gets one more reference. The first write fault on either side copies the page (see mm_cow_fault).
+// Only page-table pages are allocated here, the cost is proportional to the page-table size.
 // Return 0 on success, -1 on error.
 int mm_copy(struct mm *old, struct mm *new)
 {
@@ -240,28 +484,252 @@ int mm_copy(struct mm *old, struct mm *new)
 	// infof("new mm:");
 	// mm_print(new);
 
-	struct vma *vma = old->vma;
+	acquire(&old->lock);
 
+	struct vma *vma = old->vma;
 	while (vma) {
 		tracef("fork: mapping [%p, %p)", vma->vm_start, vma->vm_end);
 		struct vma *new_vma = mm_create_vma(new);
+		if (new_vma == NULL)
+			goto err;
 		new_vma->vm_start = vma->vm_start;
 		new_vma->vm_end = vma->vm_end;
 		new_vma->pte_flags = vma->pte_flags;
-		if (mm_mappages(new_vma)) {
-			warnf("mm_mappages");
-			goto err;
-		}
+		new_vma->vm_flags = vma->vm_flags;
+		new_vma->next = new->vma;
+		new->vma = new_vma;
+
 		for (uint64 va = vma->vm_start; va < vma->vm_end; va += PGSIZE) {
-			void *__kva pa_old = (void *)PA_TO_KVA(walkaddr(old, va));
-			void *__kva pa_new = (void *)PA_TO_KVA(walkaddr(new, va));
-			memmove(pa_new, pa_old, PGSIZE);
+			pte_t *pte_old = walk(old, va, 0);
+			if (pte_old == NULL || !(*pte_old & PTE_V))
+				continue;
+			int huge = *pte_old & PTE_HUGE;
+			pte_t *pte_new = huge ? walk_pmd(new, va, 1) : walk(new, va, 1);
+			if (pte_new == NULL) {
+				warnf("walk");
+				goto err;
+			}
+			if (*pte_old & PTE_W)
+				*pte_old = (*pte_old & ~PTE_W) | PTE_COW;
+			kpage_ref((void *)PTE2PA(*pte_old));
+			*pte_new = *pte_old;
+			if (huge)
+				va += PGSIZE_2M - PGSIZE;
 		}
 		vma = vma->next;
 	}
+	release(&old->lock);
+	// old mm lost its write permissions.
+	mm_tlb_flush_range(old, 0, MAXVA);
 
 	return 0;
 err:
+	release(&old->lock);
+	mm_tlb_flush_range(old, 0, MAXVA);
 	mm_free_pages(new);
 	return -1;
 }
+
+// Find a free range of len bytes in [MMAP_BASE, MMAP_END), aligned to align.
+// Return 0 if there is none.
+static uint64 mmap_find_range(struct mm *mm, uint64 len, uint64 align)
+{
+	uint64 start = MMAP_BASE;
+again:
+	if (start + len > MMAP_END)
+		return 0;
+	for (struct vma *vma = mm->vma; vma; vma = vma->next) {
+		if (vma->vm_start < start + len && start < vma->vm_end) {
+			start = ROUNDUP_2N(vma->vm_end, align);
+			goto again;
+		}
+	}
+	return start;
+}
+
+static int mmap_range_free(struct mm *mm, uint64 start, uint64 end)
+{
+	if (start < MMAP_BASE || end > MMAP_END || end <= start)
+		return 0;
+	for (struct vma *vma = mm->vma; vma; vma = vma->next) {
+		if (vma->vm_start < end && start < vma->vm_end)
+			return 0;
+	}
+	return 1;
+}
+
+// Create an anonymous lazy mapping of len bytes, at addr if fixed, or addr is used as a hint.
+// Requests of at least 2 MiB are placed 2 MiB-aligned and backed by 2 MiB pages (see mm_lazy_fault).
+// Return the start address, or 0 on failure.
+uint64 mm_mmap(struct mm *mm, uint64 addr, uint64 len, uint64 pte_flags, int fixed)
+{
+	// no address arithmetic below may wrap.
+	if (len == 0 || len > MMAP_END - MMAP_BASE || !PGALIGNED(addr))
+		return 0;
+	len = PGROUNDUP(len);
+	uint64 align = len >= PGSIZE_2M ? PGSIZE_2M : PGSIZE;
+
+	acquire(&mm->lock);
+	if (addr > MMAP_END - len || !mmap_range_free(mm, addr, addr + len)) {
+		addr = fixed ? 0 : mmap_find_range(mm, len, align);
+		if (addr == 0) {
+			release(&mm->lock);
+			return 0;
+		}
+	}
+
+	struct vma *vma = mm_create_vma(mm);
+	if (vma == NULL) {
+		release(&mm->lock);
+		return 0;
+	}
+	vma->vm_start = addr;
+	vma->vm_end = addr + len;
+	vma->pte_flags = pte_flags;
+	vma->vm_flags = VMA_LAZY | VMA_MMAP;
+	if (len >= PGSIZE_2M && IS_ALIGNED(addr, PGSIZE_2M))
+		vma->vm_flags |= VMA_HUGE;
+	mm_mappages(vma);
+	release(&mm->lock);
+
+	tracef("mmap: [%p, %p), flags %x", vma->vm_start, vma->vm_end, vma->vm_flags);
+	return addr;
+}
+
+// 2 MiB pages are never split, a range boundary must not fall inside one.
+static int munmap_can_cut(struct mm *mm, uint64 va)
+{
+	if (IS_ALIGNED(va, PGSIZE_2M) || !IS_USER_VA(va))
+		return 1;
+	pte_t *pte = walk(mm, va, 0);
+	return pte == NULL || !(*pte & PTE_HUGE);
+}
+
+// Remove the mappings of [addr, addr + len), the vmas partially covered are trimmed or split.
+// Only vmas created by mm_mmap can be unmapped.
+// Return 0 on success, -1 on error.
+int mm_munmap(struct mm *mm, uint64 addr, uint64 len)
+{
+	uint64 end = PGROUNDUP(addr + len);
+	if (!PGALIGNED(addr) || len == 0 || end <= addr)
+		return -1;
+
+	acquire(&mm->lock);
+	for (struct vma *vma = mm->vma; vma; vma = vma->next) {
+		if (vma->vm_start < end && addr < vma->vm_end && !(vma->vm_flags & VMA_MMAP))
+			goto err;
+	}
+	if (!munmap_can_cut(mm, addr) || !munmap_can_cut(mm, end))
+		goto err;
+
+	struct vma **pprev = &mm->vma;
+	while (*pprev) {
+		struct vma *vma = *pprev;
+		if (!(vma->vm_start < end && addr < vma->vm_end)) {
+			pprev = &vma->next;
+			continue;
+		}
+		uint64 start = MAX(addr, vma->vm_start), stop = MIN(end, vma->vm_end);
+		// a split only happens inside one vma, fail before unmapping anything.
+		struct vma *tail = NULL;
+		if (start > vma->vm_start && stop < vma->vm_end && (tail = mm_create_vma(mm)) == NULL)
+			goto err;
+		unmap_pages(vma, start, stop, true);
+		if (start == vma->vm_start && stop == vma->vm_end) {
+			*pprev = vma->next;
+			kfree(&vma_allocator, vma);
+			continue;
+		}
+		if (start == vma->vm_start) {
+			vma->vm_start = stop;
+		} else if (stop == vma->vm_end) {
+			vma->vm_end = start;
+		} else {
+			// split, the new vma takes the tail.
+			*tail = *vma;
+			tail->vm_start = stop;
+			vma->vm_end = start;
+			vma->next = tail;
+		}
+		pprev = &vma->next;
+	}
+	release(&mm->lock);
+	return 0;
+
+err:
+	release(&mm->lock);
+	return -1;
+}
+
+// Resolve a write to a copy-on-write page at va.
+// If the page is no longer shared, make it writable again, otherwise copy it.
+// Caller should hold mm->lock.
+// Return 0 on success, -1 if va is not a copy-on-write page or we are out of memory.
+int mm_cow_fault(struct mm *mm, uint64 va)
+{
+	pte_t *pte = walk(mm, PGROUNDDOWN(va), 0);
+	if (pte == NULL || !(*pte & PTE_V) || !(*pte & PTE_COW))
+		return -1;
+
+	uint64 __pa pa = PTE2PA(*pte);
+	uint64 flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W | PTE_A | PTE_D;
+
+	int order = (*pte & PTE_HUGE) ? KPAGE_MAX_ORDER : 0;
+
+	if (kpage_refcnt((void *)pa) == 1) {
+		// we are the last user of this page.
+		*pte = PA2PTE(pa) | flags;
+	} else {
+		void *__pa newpg = order ? kallocpages(order) : kallocpage();
+		if (newpg == NULL)
+			return -1;
+		for (uint64 off = 0; off < (PGSIZE << order); off += PGSIZE)
+			copy_page((void *)PA_TO_KVA((uint64)newpg + off), (void *)PA_TO_KVA(pa + off));
+		*pte = PA2PTE(newpg) | flags;
+		if (order)
+			kfreepages((void *)pa, order);
+		else
+			kfreepage((void *)pa);
+	}
+	mm_tlb_flush_page(mm, PGROUNDDOWN(va));
+	return 0;
+}
+
+// Populate the page at va, if it belongs to a VMA_LAZY vma and is not mapped yet.
+// Caller should hold mm->lock.
+// Return 0 on success, -1 if va is not in a lazy vma or we are out of memory.
+int mm_lazy_fault(struct mm *mm, uint64 va)
+{
+	struct vma *vma = mm_find_vma(mm, va);
+	if (vma == NULL || !(vma->vm_flags & VMA_LAZY))
+		return -1;
+
+	uint64 base = ROUNDDOWN_2N(va, PGSIZE_2M);
+	pte_t *pmd;
+	if ((vma->vm_flags & VMA_HUGE) && base >= vma->vm_start && base + PGSIZE_2M <= vma->vm_end &&
+	    (pmd = walk_pmd(mm, base, 1)) != NULL && !(*pmd & PTE_V)) {
+		void *__pa pa = kallocpages(KPAGE_MAX_ORDER);
+		if (pa != NULL) {
+			for (uint64 off = 0; off < PGSIZE_2M; off += PGSIZE)
+				clear_page((void *)PA_TO_KVA((uint64)pa + off));
+			*pmd = PA2PTE(pa) | vma->pte_flags | PTE_HUGE | PTE_A | PTE_D | PTE_V;
+			mm_tlb_flush_page(mm, base);
+			return 0;
+		}
+		// no free 2 MiB block, fall back to 4 KiB pages.
+	}
+
+	pte_t *pte = walk(mm, PGROUNDDOWN(va), 1);
+	if (pte == NULL)
+		return -1;
+	if (*pte & PTE_V)
+		return 0;
+
+	void *__pa pa = kallocpage_zeroed();
+	if (pa == NULL)
+		return -1;
+	// set A/D here, or VisionFive2 faults again for them.
+	*pte = PA2PTE(pa) | vma->pte_flags | PTE_A | PTE_D | PTE_V;
+	mm_tlb_flush_page(mm, PGROUNDDOWN(va));
+	return 0;
+}
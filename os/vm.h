@@ -29,6 +29,11 @@ struct kernelmap {
     pte_t pte;
 };
 
+// vma->vm_flags
+#define VMA_LAZY (1 << 0)  // anonymous memory, pages are allocated and zero-filled on first access
+#define VMA_MMAP (1 << 1)  // created by mmap(), can be munmap()-ed
+#define VMA_HUGE (1 << 2)  // lazy pages are populated with 2 MiB pages where the vma covers them
+
 struct mm;
 struct vma {
     struct mm* owner;
@@ -36,6 +41,7 @@ struct vma {
     uint64 vm_start;
     uint64 vm_end;
     uint64 pte_flags;
+    uint64 vm_flags;
 };
 struct mm {
     spinlock_t lock;
@@ -43,6 +49,10 @@ struct mm {
     pagetable_t __kva pgt;
     struct vma* vma;
     int refcnt;
+
+    uint64 asid;            // (generation << 16) | ASID, 0 if not assigned yet, see vm.c
+    uint64 tlb_stale_cpus;  // cpus that must flush this ASID before running mm again
+    uint64 cpus_active;     // cpus running mm, they are fenced remotely when mm changes
 };
 
 // kvm.c
@@ -51,6 +61,10 @@ void kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm);
 
 // vm.c
 void uvm_init();
+uint64 mm_satp(struct mm* mm, int* flush);
+void mm_deactivate(struct mm* mm);
+void mm_tlb_flush_page(struct mm* mm, uint64 va);
+void mm_tlb_flush_range(struct mm* mm, uint64 start, uint64 end);
 
 pte_t* walk(struct mm* mm, uint64 va, int alloc);
 uint64 __pa walkaddr(struct mm* mm, uint64 va);
@@ -58,17 +72,25 @@ uint64 useraddr(struct mm* mm, uint64 va);
 
 struct mm* mm_create();
 struct vma* mm_create_vma(struct mm* mm);
+struct vma* mm_find_vma(struct mm* mm, uint64 va);
 void freevma(struct vma* vma, int free_phy_page);
+int mm_resize_vma(struct vma* vma, uint64 new_end);
 void mm_free_pages(struct mm* mm);
 void mm_free(struct mm* mm);
 int mm_mappages(struct vma* vma);
 struct vma* mm_mappagesat(struct mm* mm, uint64 va, uint64 __pa pa, uint64 flags, int add_linked_list);
+void mm_unmappagesat(struct vma* vma, int free_phy_page);
 int mm_copy(struct mm* old, struct mm* new);
+uint64 mm_mmap(struct mm* mm, uint64 addr, uint64 len, uint64 pte_flags, int fixed);
+int mm_munmap(struct mm* mm, uint64 addr, uint64 len);
+int mm_cow_fault(struct mm* mm, uint64 va);
+int mm_lazy_fault(struct mm* mm, uint64 va);
 
 // uaccess.c
 int copy_to_user(struct mm* mm, uint64 __user dstva, char* src, uint64 len);
 int copy_from_user(struct mm* mm, char* dst, uint64 __user srcva, uint64 len);
 int copystr_from_user(struct mm* mm, char* dst, uint64 __user srcva, uint64 max);
+uint64 uaccess_fixup(uint64 epc);
 
 void vm_print(pagetable_t pagetable);
 